@@ -5,8 +5,10 @@ layout (location = 1) in vec2 tex;
 
 out vec2 vertex_texture_coords;
 
+uniform bool is_transposed;
+
 void main() {
-	vertex_texture_coords = tex;
+	vertex_texture_coords = (is_transposed) ? tex.yx : tex;
 	gl_Position = vec4(pos, 0.0, 1.0);
 }
 
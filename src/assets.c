@@ -0,0 +1,117 @@
+#include "assets.h"
+#include "logging.h"
+#include "error.h"
+#include "texture.h"
+#include "jobs.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Textures are requested by filename and handed back as handles - requesting the same file twice gives the same handle
+// Requested textures are decoded in the background by the job system once loading starts, and fetching a texture
+// waits for it to finish
+// The assets own every texture they load
+
+struct rc_assets_texture {
+	char *filename;
+	struct rc_texture *texture;
+};
+
+struct rc_assets {
+	struct rc_job_system *jobs;
+	int texture_colors_count;
+	int textures_count, textures_capacity;
+	struct rc_assets_texture *textures;
+
+	// Textures [first_loading_texture, loaded_textures_count) are being decoded by the current batch
+	bool is_loading;
+	int first_loading_texture, loaded_textures_count;
+};
+
+static void rc_assets_internal_load_texture(void *assets, int job_index);
+static void rc_assets_internal_finish_loading(struct rc_assets *assets);
+
+struct rc_assets *rc_assets_create(struct rc_job_system *jobs) {
+	rc_log(RC_LOG_VERBOSE, "Creating new asset manager...");
+	struct rc_assets *assets = calloc(1, sizeof *assets);
+	RC_ASSERT(assets);
+	assets->jobs = jobs;
+	return assets;
+}
+
+int rc_assets_request_texture(struct rc_assets *assets, const char *filename) {
+	for (int i = 0; i < assets->textures_count; i++)
+		if (strcmp(assets->textures[i].filename, filename) == 0)
+			return i;
+
+	// The batch being decoded writes into the texture array, so it can't be moved until the batch is finished
+	if (assets->textures_count == assets->textures_capacity) {
+		rc_assets_internal_finish_loading(assets);
+		assets->textures_capacity = (assets->textures_capacity) ? assets->textures_capacity * 2 : 16;
+		assets->textures = realloc(assets->textures, sizeof *assets->textures * assets->textures_capacity);
+		RC_ASSERT(assets->textures);
+	}
+
+	rc_log(RC_LOG_VERBOSE, "Requesting texture '%s'...", filename);
+	char *filename_copy = malloc(strlen(filename) + 1);
+	RC_ASSERT(filename_copy);
+	strcpy(filename_copy, filename);
+	assets->textures[assets->textures_count] = (struct rc_assets_texture) { filename_copy, NULL };
+	return assets->textures_count++;
+}
+
+// Textures loaded from now on are also quantized to palettes of this many colours, or not at all if zero
+void rc_assets_set_texture_colors(struct rc_assets *assets, int colors_count) {
+	RC_ASSERT(colors_count >= 0 && colors_count <= 256);
+	rc_assets_internal_finish_loading(assets);
+	assets->texture_colors_count = colors_count;
+}
+
+// Start decoding every texture requested since the last load, the caller is free to do other work in the meantime
+void rc_assets_load(struct rc_assets *assets) {
+	rc_assets_internal_finish_loading(assets);
+	if (assets->loaded_textures_count == assets->textures_count)
+		return;
+	rc_log(RC_LOG_INFO, "Loading %i textures...", assets->textures_count - assets->loaded_textures_count);
+	assets->is_loading = true;
+	assets->first_loading_texture = assets->loaded_textures_count;
+	assets->loaded_textures_count = assets->textures_count;
+	rc_job_system_start(assets->jobs, rc_assets_internal_load_texture, assets, assets->loaded_textures_count - assets->first_loading_texture);
+}
+
+// Waits for the texture if it is still being decoded, or loads it now if loading hasn't been started for it
+struct rc_texture *rc_assets_get_texture(struct rc_assets *assets, int texture) {
+	RC_ASSERT(texture >= 0 && texture < assets->textures_count);
+	if (texture >= assets->loaded_textures_count)
+		rc_assets_load(assets);
+	if (texture >= assets->first_loading_texture)
+		rc_assets_internal_finish_loading(assets);
+	return assets->textures[texture].texture;
+}
+
+void rc_assets_destroy(struct rc_assets *assets) {
+	rc_log(RC_LOG_VERBOSE, "Destroying asset manager...");
+	rc_assets_internal_finish_loading(assets);
+	for (int i = 0; i < assets->textures_count; i++) {
+		if (assets->textures[i].texture)
+			rc_texture_unload(assets->textures[i].texture);
+		free(assets->textures[i].filename);
+	}
+	free(assets->textures);
+	free(assets);
+}
+
+static void rc_assets_internal_load_texture(void *data, int job_index) {
+	struct rc_assets *assets = data;
+	struct rc_assets_texture *texture = &assets->textures[assets->first_loading_texture + job_index];
+	texture->texture = rc_texture_load(texture->filename);
+	if (assets->texture_colors_count > 0)
+		rc_texture_quantize(texture->texture, assets->texture_colors_count);
+}
+
+static void rc_assets_internal_finish_loading(struct rc_assets *assets) {
+	if (!assets->is_loading)
+		return;
+	rc_job_system_wait(assets->jobs);
+	assets->is_loading = false;
+}
@@ -0,0 +1,15 @@
+#ifndef RC_ASSETS_H
+#define RC_ASSETS_H
+
+struct rc_texture;
+struct rc_job_system;
+struct rc_assets;
+
+struct rc_assets *rc_assets_create(struct rc_job_system *jobs);
+void rc_assets_set_texture_colors(struct rc_assets *assets, int colors_count);
+int rc_assets_request_texture(struct rc_assets *assets, const char *filename);
+void rc_assets_load(struct rc_assets *assets);
+struct rc_texture *rc_assets_get_texture(struct rc_assets *assets, int texture);
+void rc_assets_destroy(struct rc_assets *assets);
+
+#endif
@@ -0,0 +1,69 @@
+#include "collision.h"
+#include "map.h"
+#include <stdbool.h>
+#include <math.h>
+
+// Circles never move further than this in one step, so they can't pass through a wall between steps
+#define RC_COLLISION_MAX_STEP 0.25
+
+static bool rc_collision_internal_is_solid(const struct rc_map *map, int x, int y);
+
+// Sweep a circle from its position towards a target, sliding along any walls it hits on the way
+bool rc_collision_move_circle(const struct rc_map *map, double radius, double *x, double *y, double target_x, double target_y) {
+	const double delta_x = target_x - *x, delta_y = target_y - *y;
+	const double max_step = fmin(RC_COLLISION_MAX_STEP, radius);
+	const int steps_count = fmax(ceil(sqrt(delta_x * delta_x + delta_y * delta_y) / max_step), 1);
+	bool has_collided = false;
+	for (int i = 0; i < steps_count; i++) {
+		*x += delta_x / steps_count;
+		*y += delta_y / steps_count;
+		has_collided |= rc_collision_push_circle(map, radius, x, y);
+	}
+	return has_collided;
+}
+
+// Push a circle out of any walls it overlaps
+bool rc_collision_push_circle(const struct rc_map *map, double radius, double *x, double *y) {
+	bool has_collided = false;
+	const int first_tile_x = floor(*x - radius), last_tile_x = floor(*x + radius);
+	const int first_tile_y = floor(*y - radius), last_tile_y = floor(*y + radius);
+	for (int tile_y = first_tile_y; tile_y <= last_tile_y; tile_y++) {
+		for (int tile_x = first_tile_x; tile_x <= last_tile_x; tile_x++) {
+			if (!rc_collision_internal_is_solid(map, tile_x, tile_y))
+				continue;
+
+			// Closest point of the tile to the center of the circle
+			const double closest_x = fmin(fmax(*x, tile_x), tile_x + 1);
+			const double closest_y = fmin(fmax(*y, tile_y), tile_y + 1);
+			const double offset_x = *x - closest_x, offset_y = *y - closest_y;
+			const double distance = sqrt(offset_x * offset_x + offset_y * offset_y);
+			if (distance >= radius)
+				continue;
+
+			// Push out along the shortest axis if the center is inside the tile, else away from the closest point
+			if (distance == 0) {
+				const double push_left = *x - tile_x + radius, push_right = tile_x + 1 - *x + radius;
+				const double push_up = *y - tile_y + radius, push_down = tile_y + 1 - *y + radius;
+				const double min_push = fmin(fmin(push_left, push_right), fmin(push_up, push_down));
+				if (min_push == push_left)       *x -= push_left;
+				else if (min_push == push_right) *x += push_right;
+				else if (min_push == push_up)    *y -= push_up;
+				else                             *y += push_down;
+			} else {
+				*x += offset_x / distance * (radius - distance);
+				*y += offset_y / distance * (radius - distance);
+			}
+			has_collided = true;
+		}
+	}
+	return has_collided;
+}
+
+// Tiles outside the map are solid
+static bool rc_collision_internal_is_solid(const struct rc_map *map, int x, int y) {
+	int map_width, map_height;
+	rc_map_get_size(map, &map_width, &map_height);
+	if (x < 0 || x >= map_width || y < 0 || y >= map_height)
+		return true;
+	return rc_map_get_wall(map, x, y) != -1;
+}
@@ -0,0 +1,11 @@
+#ifndef RC_COLLISION_H
+#define RC_COLLISION_H
+
+#include <stdbool.h>
+
+struct rc_map;
+
+bool rc_collision_move_circle(const struct rc_map *map, double radius, double *x, double *y, double target_x, double target_y);
+bool rc_collision_push_circle(const struct rc_map *map, double radius, double *x, double *y);
+
+#endif
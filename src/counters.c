@@ -0,0 +1,163 @@
+#include "counters.h"
+#include "logging.h"
+#include "platform.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef RC_LINUX
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Counters run freely from initialization, so a section reads them when it begins and again when it ends
+// The kernel may time-share counters between events, so deltas are scaled up by how long each one was really counting
+
+struct rc_counters_reading {
+	uint64_t value, time_enabled, time_running;
+};
+
+struct rc_counters_totals {
+	int samples_count;
+	double values[rc_counters_event_count];
+	struct rc_counters_reading begin[rc_counters_event_count];
+};
+
+static const char *RC_COUNTERS_EVENT_NAMES[rc_counters_event_count] = { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses" };
+static const char *RC_COUNTERS_SECTION_NAMES[rc_counters_section_count] = { "floor_and_ceiling", "walls", "sprites", "lighting" };
+
+static bool is_initiated = false;
+static int event_fds[rc_counters_event_count];
+static struct rc_counters_totals totals[rc_counters_section_count];
+
+static void rc_counters_internal_read(struct rc_counters_reading readings[rc_counters_event_count]);
+
+// Returns false if none of the counters can be used, which is common in containers and virtual machines
+bool rc_counters_init(void) {
+	rc_log(RC_LOG_INFO, "Initializing hardware performance counters...");
+	for (int i = 0; i < rc_counters_event_count; i++)
+		event_fds[i] = -1;
+	rc_counters_reset();
+
+#ifdef RC_LINUX
+	const struct { uint32_t type; uint64_t config; } events[rc_counters_event_count] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES }
+	};
+
+	// Count user space only on this thread, which is all an unprivileged process is usually allowed
+	int available_events_count = 0;
+	for (int i = 0; i < rc_counters_event_count; i++) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof attr);
+		attr.size = sizeof attr;
+		attr.type = events[i].type;
+		attr.config = events[i].config;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		event_fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (event_fds[i] == -1) {
+			rc_log(RC_LOG_WARN, "Hardware performance counter '%s' is unavailable!", RC_COUNTERS_EVENT_NAMES[i]);
+			continue;
+		}
+		available_events_count++;
+	}
+	is_initiated = available_events_count > 0;
+#else
+	rc_log(RC_LOG_WARN, "Hardware performance counters are only supported on Linux!");
+#endif
+
+	return is_initiated;
+}
+
+const char *rc_counters_get_event_name(enum rc_counters_event event) {
+	return RC_COUNTERS_EVENT_NAMES[event];
+}
+
+const char *rc_counters_get_section_name(enum rc_counters_section section) {
+	return RC_COUNTERS_SECTION_NAMES[section];
+}
+
+void rc_counters_begin(enum rc_counters_section section) {
+	if (!is_initiated)
+		return;
+	rc_counters_internal_read(totals[section].begin);
+}
+
+void rc_counters_end(enum rc_counters_section section) {
+	if (!is_initiated)
+		return;
+	struct rc_counters_reading end[rc_counters_event_count];
+	rc_counters_internal_read(end);
+	struct rc_counters_totals *section_totals = &totals[section];
+	for (int i = 0; i < rc_counters_event_count; i++) {
+		const struct rc_counters_reading *begin = &section_totals->begin[i];
+		const uint64_t time_running = end[i].time_running - begin->time_running;
+		if (time_running > 0)
+			section_totals->values[i] += (double) (end[i].value - begin->value) * (end[i].time_enabled - begin->time_enabled) / time_running;
+	}
+	section_totals->samples_count++;
+}
+
+// Fills in the totals counted in a section since the last reset, and returns how many times it was counted
+// Events which can't be counted are given as -1
+int rc_counters_get(enum rc_counters_section section, double values[rc_counters_event_count]) {
+	for (int i = 0; i < rc_counters_event_count; i++)
+		values[i] = (!is_initiated || event_fds[i] == -1) ? -1 : totals[section].values[i];
+	return totals[section].samples_count;
+}
+
+// Write the totals divided between the given number of runs as a JSON object with a member for each section which was
+// counted, where events the hardware can't count are null
+void rc_counters_write_json(FILE *file, double runs_count) {
+	fputc('{', file);
+	bool is_first_section = true;
+	for (int section = 0; section < rc_counters_section_count; section++) {
+		double values[rc_counters_event_count];
+		if (rc_counters_get(section, values) == 0)
+			continue;
+		fprintf(file, "%s\"%s\": {", (is_first_section) ? "" : ", ", RC_COUNTERS_SECTION_NAMES[section]);
+		for (int event = 0; event < rc_counters_event_count; event++) {
+			fprintf(file, (event == 0) ? "\"%s\": " : ", \"%s\": ", RC_COUNTERS_EVENT_NAMES[event]);
+			if (values[event] < 0)
+				fputs("null", file);
+			else
+				fprintf(file, "%.0f", values[event] / runs_count);
+		}
+		fputc('}', file);
+		is_first_section = false;
+	}
+	fputc('}', file);
+}
+
+void rc_counters_reset(void) {
+	memset(totals, 0, sizeof totals);
+}
+
+void rc_counters_cleanup(void) {
+	if (!is_initiated)
+		return;
+	rc_log(RC_LOG_INFO, "Cleaning up hardware performance counters...");
+#ifdef RC_LINUX
+	for (int i = 0; i < rc_counters_event_count; i++)
+		if (event_fds[i] != -1)
+			close(event_fds[i]);
+#endif
+	for (int i = 0; i < rc_counters_event_count; i++)
+		event_fds[i] = -1;
+	is_initiated = false;
+}
+
+static void rc_counters_internal_read(struct rc_counters_reading readings[rc_counters_event_count]) {
+	for (int i = 0; i < rc_counters_event_count; i++) {
+		readings[i] = (struct rc_counters_reading) { 0 };
+#ifdef RC_LINUX
+		if (event_fds[i] != -1 && read(event_fds[i], &readings[i], sizeof readings[i]) != sizeof readings[i])
+			rc_log(RC_LOG_WARN, "Could not read hardware performance counter '%s'!", RC_COUNTERS_EVENT_NAMES[i]);
+#endif
+	}
+}
@@ -0,0 +1,37 @@
+#ifndef RC_COUNTERS_H
+#define RC_COUNTERS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+
+// Hardware performance counters attributed to the hot sections of a frame
+// Only the thread which initialized the counters is counted, and sections are no-ops until then
+
+enum rc_counters_event {
+	RC_COUNTERS_CYCLES = 0,
+	RC_COUNTERS_INSTRUCTIONS,
+	RC_COUNTERS_L1D_MISSES,
+	RC_COUNTERS_LLC_MISSES,
+	RC_COUNTERS_BRANCH_MISSES,
+	rc_counters_event_count
+};
+
+enum rc_counters_section {
+	RC_COUNTERS_FLOOR_AND_CEILING = 0,
+	RC_COUNTERS_WALLS,
+	RC_COUNTERS_SPRITES,
+	RC_COUNTERS_LIGHTING,
+	rc_counters_section_count
+};
+
+bool rc_counters_init(void);
+const char *rc_counters_get_event_name(enum rc_counters_event event);
+const char *rc_counters_get_section_name(enum rc_counters_section section);
+void rc_counters_begin(enum rc_counters_section section);
+void rc_counters_end(enum rc_counters_section section);
+int rc_counters_get(enum rc_counters_section section, double values[rc_counters_event_count]);
+void rc_counters_write_json(FILE *file, double runs_count);
+void rc_counters_reset(void);
+void rc_counters_cleanup(void);
+
+#endif
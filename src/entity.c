@@ -1,61 +1,738 @@
 #include "entity.h"
 #include "logging.h"
 #include "error.h"
+#include "jobs.h"
+#include "map.h"
+#include "light.h"
+#include "collision.h"
+#include "profile.h"
+#include "platform.h"
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
-struct rc_entity {
-	double x, y, z, r;
-	const struct rc_texture *texture;
+// Entities are updated in fixed size chunks so the order of deferred changes doesn't depend on the number of threads
+#define RC_ENTITY_UPDATE_CHUNK_SIZE 256
+
+struct rc_entity_behavior {
+	entity_init_func init_function;
 	entity_update_func update_function;
 	entity_destroy_func destroy_function;
-	void *data_pointer;
 };
 
-struct rc_entity *rc_entity_create(double x, double y, double z, double r, const struct rc_texture *texture, entity_init_func init_function, entity_update_func update_function, entity_destroy_func destroy_function) {
+struct rc_entity_spawn {
+	double x, y, z, r;
+	const struct rc_texture *texture;
+	int behavior;
+};
+
+struct rc_entity_queue {
+	int spawns_count, spawns_capacity;
+	struct rc_entity_spawn *spawns;
+	int despawns_count, despawns_capacity;
+	struct rc_entity_handle *despawns;
+};
+
+struct rc_entity_update_job {
+	struct rc_entity_pool *pool;
+	const struct rc_map *map;
+};
+
+struct rc_entity_pool {
+
+	// Entity data is stored as densely packed arrays - entities [0, count) are alive
+	int count, capacity;
+	double *x, *y, *z, *r;
+	double *previous_x, *previous_y, *previous_z, *previous_r;
+	const struct rc_texture **textures;
+	int *behaviors;
+	void **data_pointers;
+	struct rc_light **lights;
+	double *radii;
+	bool *has_collided;
+	int *dense_slots;
+
+	// Handles index into slots, which track where an entity lives in the dense arrays
+	// Unused slots form a freelist through their dense index
+	unsigned *slot_generations;
+	int *slot_dense_indices;
+	int free_slot;
+
+	// Entity lights are added to the map and follow their entity
+	struct rc_map *map;
+
+	// Uniform grid of map tiles - each cell holds a doubly linked list of the slots of the entities within it
+	int grid_width, grid_height;
+	int *cell_heads;
+	int *slot_cells, *slot_cell_next, *slot_cell_prev;
+
+	// Entities with a radius collide with walls and each other - the largest radius bounds how far apart cells can collide
+	double max_radius;
+	double *push_x, *push_y;
+
+	int behaviors_count;
+	struct rc_entity_behavior *behavior_table;
+
+	// During an update entities read the state from the start of the tick and stage their new transforms
+	bool is_updating, is_committing;
+	double *staged_x, *staged_y, *staged_z, *staged_r;
+	bool *is_staged;
+
+	// Spawns and despawns are deferred until the end of the update - each chunk of entities has its own queue, and
+	// requests from outside an update go into the external queue which is processed last
+	// These queues are reused between ticks so bursts of short-lived entities don't hit the allocator
+	int updated_chunks_count, queues_capacity;
+	struct rc_entity_queue *queues;
+	struct rc_entity_queue external_queue;
+};
+
+// The chunk and dense index of the entity being updated on this thread, or -1 outside an update function
+static _Thread_local int current_update_chunk = -1, current_update_entity = -1;
+
+static void rc_entity_internal_update_chunk(void *update_job, int chunk);
+static void rc_entity_internal_resolve_collisions(struct rc_entity_pool *pool);
+static void rc_entity_internal_move(struct rc_entity_pool *pool, int dense_index, double x, double y, double z, double r);
+static struct rc_entity_queue *rc_entity_internal_get_queue(struct rc_entity_pool *pool);
+static void rc_entity_internal_free_queue(struct rc_entity_queue *queue);
+static int rc_entity_internal_reserve_slot(struct rc_entity_pool *pool);
+static void rc_entity_internal_insert(struct rc_entity_pool *pool, int slot, double x, double y, double z, double r, const struct rc_texture *texture, int behavior);
+static void rc_entity_internal_grow(struct rc_entity_pool *pool, int capacity);
+static void *rc_entity_internal_resize_array(void *array, size_t element_size, int capacity);
+static int rc_entity_internal_get_cell(const struct rc_entity_pool *pool, double x, double y);
+static void rc_entity_internal_link_cell(struct rc_entity_pool *pool, int slot, int cell);
+static void rc_entity_internal_unlink_cell(struct rc_entity_pool *pool, int slot);
+static int rc_entity_internal_get_dense_index(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+static struct rc_entity_handle rc_entity_internal_get_handle(const struct rc_entity_pool *pool, int dense_index);
+
+struct rc_entity_pool *rc_entity_pool_create(int initial_capacity, struct rc_map *map) {
+	rc_log(RC_LOG_VERBOSE, "Creating new entity pool...");
+	int grid_width, grid_height;
+	rc_map_get_size(map, &grid_width, &grid_height);
+	RC_ASSERT(grid_width >= 1 && grid_height >= 1);
+	struct rc_entity_pool *pool = calloc(1, sizeof *pool);
+	RC_ASSERT(pool);
+	pool->free_slot = -1;
+	pool->map = map;
+	pool->grid_width = grid_width;
+	pool->grid_height = grid_height;
+	pool->cell_heads = malloc(sizeof *pool->cell_heads * grid_width * grid_height);
+	RC_ASSERT(pool->cell_heads);
+	for (int i = 0; i < grid_width * grid_height; i++)
+		pool->cell_heads[i] = -1;
+	rc_entity_internal_grow(pool, (initial_capacity > 0) ? initial_capacity : 1);
+	return pool;
+}
+
+int rc_entity_pool_add_behavior(struct rc_entity_pool *pool, entity_init_func init_function, entity_update_func update_function, entity_destroy_func destroy_function) {
+	pool->behavior_table = rc_entity_internal_resize_array(pool->behavior_table, sizeof *pool->behavior_table, pool->behaviors_count + 1);
+	pool->behavior_table[pool->behaviors_count] = (struct rc_entity_behavior) { init_function, update_function, destroy_function };
+	return pool->behaviors_count++;
+}
+
+int rc_entity_pool_get_count(const struct rc_entity_pool *pool) {
+	return pool->count;
+}
+
+void rc_entity_pool_get_transforms(const struct rc_entity_pool *pool, const double **x, const double **y, const double **z, const double **r) {
+	*x = pool->x;
+	*y = pool->y;
+	*z = pool->z;
+	*r = pool->r;
+}
+
+// Transforms from the start of the last update, to be interpolated towards the current transforms
+void rc_entity_pool_get_previous_transforms(const struct rc_entity_pool *pool, const double **x, const double **y, const double **z, const double **r) {
+	*x = pool->previous_x;
+	*y = pool->previous_y;
+	*z = pool->previous_z;
+	*r = pool->previous_r;
+}
+
+const struct rc_texture *const *rc_entity_pool_get_textures(const struct rc_entity_pool *pool) {
+	return pool->textures;
+}
+
+int rc_entity_pool_query_radius(const struct rc_entity_pool *pool, double x, double y, double radius, struct rc_entity_handle *results, int max_results) {
+	const int first_cell_x = fmax(floor(x - radius), 0), last_cell_x = fmin(floor(x + radius), pool->grid_width - 1);
+	const int first_cell_y = fmax(floor(y - radius), 0), last_cell_y = fmin(floor(y + radius), pool->grid_height - 1);
+	int results_count = 0;
+	for (int cell_y = first_cell_y; cell_y <= last_cell_y; cell_y++) {
+		for (int cell_x = first_cell_x; cell_x <= last_cell_x; cell_x++) {
+			for (int slot = pool->cell_heads[cell_y * pool->grid_width + cell_x]; slot != -1; slot = pool->slot_cell_next[slot]) {
+				const int i = pool->slot_dense_indices[slot];
+				const double offset_x = pool->x[i] - x, offset_y = pool->y[i] - y;
+				if (offset_x * offset_x + offset_y * offset_y > radius * radius)
+					continue;
+				if (results_count == max_results)
+					return results_count;
+				results[results_count++] = rc_entity_internal_get_handle(pool, i);
+			}
+		}
+	}
+	return results_count;
+}
+
+// Results are indices into the dense arrays, so they are only valid until the pool next changes
+int rc_entity_pool_query_frustum(const struct rc_entity_pool *pool, double x, double y, double r, double fov, double range, double margin, int *results, int max_results) {
+
+	// Bounding box of the view triangle, where fov is the half-width of the camera plane one unit in-front of the camera
+	const double forward_x = cos(r), forward_y = sin(r);
+	const double left_x = range * (forward_x + forward_y * fov), left_y = range * (forward_y - forward_x * fov);
+	const double right_x = range * (forward_x - forward_y * fov), right_y = range * (forward_y + forward_x * fov);
+	const int first_cell_x = fmax(floor(x + fmin(0, fmin(left_x, right_x)) - margin), 0);
+	const int last_cell_x = fmin(floor(x + fmax(0, fmax(left_x, right_x)) + margin), pool->grid_width - 1);
+	const int first_cell_y = fmax(floor(y + fmin(0, fmin(left_y, right_y)) - margin), 0);
+	const int last_cell_y = fmin(floor(y + fmax(0, fmax(left_y, right_y)) + margin), pool->grid_height - 1);
+
+	// Cells are culled by testing their bounding circle against the view, then entities within them are tested individually
+	// Edge cells also hold entities outside the map, so they are never culled
+	const double cell_margin = margin + sqrt(0.5);
+	const double fov_scale = sqrt(1 + fov * fov);
+	int results_count = 0;
+	for (int cell_y = first_cell_y; cell_y <= last_cell_y; cell_y++) {
+		for (int cell_x = first_cell_x; cell_x <= last_cell_x; cell_x++) {
+			const double cell_offset_x = cell_x + 0.5 - x, cell_offset_y = cell_y + 0.5 - y;
+			const double cell_depth = cell_offset_x * forward_x + cell_offset_y * forward_y;
+			const double cell_side = cell_offset_y * forward_x - cell_offset_x * forward_y;
+			const bool is_edge_cell = cell_x == 0 || cell_x == pool->grid_width - 1 || cell_y == 0 || cell_y == pool->grid_height - 1;
+			if (!is_edge_cell && (cell_depth < -cell_margin || cell_depth > range + cell_margin || fabs(cell_side) - cell_depth * fov > cell_margin * fov_scale))
+				continue;
+
+			for (int slot = pool->cell_heads[cell_y * pool->grid_width + cell_x]; slot != -1; slot = pool->slot_cell_next[slot]) {
+				const int i = pool->slot_dense_indices[slot];
+				const double offset_x = pool->x[i] - x, offset_y = pool->y[i] - y;
+				const double depth = offset_x * forward_x + offset_y * forward_y;
+				const double side = offset_y * forward_x - offset_x * forward_y;
+				if (depth <= 0 || depth > range || fabs(side) - depth * fov > margin)
+					continue;
+				if (results_count == max_results)
+					return results_count;
+				results[results_count++] = i;
+			}
+		}
+	}
+	return results_count;
+}
+
+void rc_entity_pool_update(struct rc_entity_pool *pool, const struct rc_map *map, struct rc_job_system *jobs) {
+	RC_ASSERT(!pool->is_updating && !pool->is_committing);
+
+	// Remember where entities were at the start of the tick so rendering can interpolate towards where they end up
+	memcpy(pool->previous_x, pool->x, sizeof *pool->x * pool->count);
+	memcpy(pool->previous_y, pool->y, sizeof *pool->y * pool->count);
+	memcpy(pool->previous_z, pool->z, sizeof *pool->z * pool->count);
+	memcpy(pool->previous_r, pool->r, sizeof *pool->r * pool->count);
+
+	// Make sure every chunk has a queue for its deferred changes
+	const int chunks_count = (pool->count + RC_ENTITY_UPDATE_CHUNK_SIZE - 1) / RC_ENTITY_UPDATE_CHUNK_SIZE;
+	if (chunks_count > pool->queues_capacity) {
+		pool->queues = rc_entity_internal_resize_array(pool->queues, sizeof *pool->queues, chunks_count);
+		for (int i = pool->queues_capacity; i < chunks_count; i++)
+			pool->queues[i] = (struct rc_entity_queue) { 0 };
+		pool->queues_capacity = chunks_count;
+	}
+
+	// Behaviors only read the pool during this phase, so chunks can be updated on any thread in any order
+	struct rc_entity_update_job update_job = { pool, map };
+	pool->is_updating = true;
+	if (jobs)
+		rc_job_system_run(jobs, rc_entity_internal_update_chunk, &update_job, chunks_count);
+	else
+		for (int i = 0; i < chunks_count; i++)
+			rc_entity_internal_update_chunk(&update_job, i);
+	pool->is_updating = false;
+	pool->updated_chunks_count = chunks_count;
+
+	rc_entity_pool_commit(pool);
+}
+
+void rc_entity_pool_commit(struct rc_entity_pool *pool) {
+	RC_ASSERT(!pool->is_updating);
+	RC_PROFILE_BEGIN("rc_entity_pool_commit");
+
+	// Apply staged transforms in entity order, sweeping colliding entities towards their new position
+	for (int i = 0; i < pool->count; i++) {
+		pool->has_collided[i] = false;
+		if (pool->is_staged[i]) {
+			pool->is_staged[i] = false;
+			double x = pool->x[i], y = pool->y[i];
+			if (pool->radii[i] > 0)
+				pool->has_collided[i] = rc_collision_move_circle(pool->map, pool->radii[i], &x, &y, pool->staged_x[i], pool->staged_y[i]);
+			else
+				x = pool->staged_x[i], y = pool->staged_y[i];
+			rc_entity_internal_move(pool, i, x, y, pool->staged_z[i], pool->staged_r[i]);
+		}
+	}
+	rc_entity_internal_resolve_collisions(pool);
+
+	// Despawns first so their slots and dense storage can be reused by this ticks spawns
+	// An entity may have been despawned more than once, so skip handles which are already dead
+	for (int i = 0; i <= pool->updated_chunks_count; i++) {
+		struct rc_entity_queue *queue = (i < pool->updated_chunks_count) ? &pool->queues[i] : &pool->external_queue;
+		for (int j = 0; j < queue->despawns_count; j++)
+			if (rc_entity_is_alive(pool, queue->despawns[j]))
+				rc_entity_destroy(pool, queue->despawns[j]);
+		queue->despawns_count = 0;
+	}
+
+	// Spawns are inserted in chunk order then request order
+	// Init functions may spawn more entities into the external queue, so it is allowed to grow while its processed
+	pool->is_committing = true;
+	for (int i = 0; i <= pool->updated_chunks_count; i++) {
+		struct rc_entity_queue *queue = (i < pool->updated_chunks_count) ? &pool->queues[i] : &pool->external_queue;
+		for (int j = 0; j < queue->spawns_count; j++) {
+			const struct rc_entity_spawn spawn = queue->spawns[j];
+			rc_entity_internal_insert(pool, rc_entity_internal_reserve_slot(pool), spawn.x, spawn.y, spawn.z, spawn.r, spawn.texture, spawn.behavior);
+		}
+		queue->spawns_count = 0;
+	}
+	pool->is_committing = false;
+	pool->updated_chunks_count = 0;
+	RC_PROFILE_END();
+}
+
+// Spawns which were never committed are dropped without calling their init functions - they hold no slots yet
+void rc_entity_pool_destroy(struct rc_entity_pool *pool) {
+	rc_log(RC_LOG_VERBOSE, "Destroying entity pool...");
+	RC_ASSERT(!pool->is_updating && !pool->is_committing);
+	for (int i = 0; i < pool->queues_capacity; i++)
+		pool->queues[i].spawns_count = pool->queues[i].despawns_count = 0;
+	pool->external_queue.spawns_count = pool->external_queue.despawns_count = 0;
+	while (pool->count > 0)
+		rc_entity_destroy(pool, rc_entity_internal_get_handle(pool, pool->count - 1));
+	free(pool->x);
+	free(pool->y);
+	free(pool->z);
+	free(pool->r);
+	free(pool->previous_x);
+	free(pool->previous_y);
+	free(pool->previous_z);
+	free(pool->previous_r);
+	free(pool->textures);
+	free(pool->behaviors);
+	free(pool->data_pointers);
+	free(pool->lights);
+	free(pool->radii);
+	free(pool->has_collided);
+	free(pool->push_x);
+	free(pool->push_y);
+	free(pool->dense_slots);
+	free(pool->slot_generations);
+	free(pool->slot_dense_indices);
+	free(pool->cell_heads);
+	free(pool->slot_cells);
+	free(pool->slot_cell_next);
+	free(pool->slot_cell_prev);
+	free(pool->behavior_table);
+	free(pool->staged_x);
+	free(pool->staged_y);
+	free(pool->staged_z);
+	free(pool->staged_r);
+	free(pool->is_staged);
+	for (int i = 0; i < pool->queues_capacity; i++)
+		rc_entity_internal_free_queue(&pool->queues[i]);
+	free(pool->queues);
+	rc_entity_internal_free_queue(&pool->external_queue);
+	free(pool);
+}
+
+struct rc_entity_handle rc_entity_create(struct rc_entity_pool *pool, double x, double y, double z, double r, const struct rc_texture *texture, int behavior) {
 	rc_log(RC_LOG_VERBOSE, "Creating new entity...");
-	struct rc_entity *entity = malloc(sizeof *entity);
-	RC_ASSERT(entity);
-	*entity = (struct rc_entity) { x, y, z, r, texture, update_function, destroy_function };
-	if (init_function)
-		init_function(entity);
-	return entity;
+	RC_ASSERT(!pool->is_updating && !pool->is_committing);
+	RC_ASSERT(behavior == RC_ENTITY_BEHAVIOR_NONE || (behavior >= 0 && behavior < pool->behaviors_count));
+	const int slot = rc_entity_internal_reserve_slot(pool);
+	rc_entity_internal_insert(pool, slot, x, y, z, r, texture, behavior);
+	return (struct rc_entity_handle) { slot, pool->slot_generations[slot] };
 }
 
-void rc_entity_set_transform(struct rc_entity *entity, double x, double y, double z, double r) {
-	entity->x = x;
-	entity->y = y;
-	entity->z = z;
-	entity->r = r;
+// Slots are only assigned when the spawn is committed, so they are the same no matter which thread requested them
+// The entity can get its handle through its behaviors init function
+void rc_entity_spawn(struct rc_entity_pool *pool, double x, double y, double z, double r, const struct rc_texture *texture, int behavior) {
+	RC_ASSERT(behavior == RC_ENTITY_BEHAVIOR_NONE || (behavior >= 0 && behavior < pool->behaviors_count));
+	struct rc_entity_queue *queue = rc_entity_internal_get_queue(pool);
+	if (queue->spawns_count == queue->spawns_capacity) {
+		queue->spawns_capacity = (queue->spawns_capacity) ? queue->spawns_capacity * 2 : 16;
+		queue->spawns = rc_entity_internal_resize_array(queue->spawns, sizeof *queue->spawns, queue->spawns_capacity);
+	}
+	queue->spawns[queue->spawns_count++] = (struct rc_entity_spawn) { x, y, z, r, texture, behavior };
 }
 
-void rc_entity_get_transform(const struct rc_entity *entity, double *x, double *y, double *z, double *r) {
-	*x = entity->x;
-	*y = entity->y;
-	*z = entity->z;
-	*r = entity->r;
+bool rc_entity_is_alive(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	if (entity.index < 0 || entity.index >= pool->capacity || pool->slot_generations[entity.index] != entity.generation)
+		return false;
+	const int dense_index = pool->slot_dense_indices[entity.index];
+	return dense_index >= 0 && dense_index < pool->count && pool->dense_slots[dense_index] == entity.index;
+}
+
+// During an update, entities may only set their own transform - it is staged and applied when the update is committed
+// Only staged transforms collide or are interpolated, so setting a transform outside an update teleports the entity
+void rc_entity_set_transform(struct rc_entity_pool *pool, struct rc_entity_handle entity, double x, double y, double z, double r) {
+	const int i = rc_entity_internal_get_dense_index(pool, entity);
+	if (pool->is_updating) {
+		RC_ASSERT(i == current_update_entity);
+		pool->staged_x[i] = x;
+		pool->staged_y[i] = y;
+		pool->staged_z[i] = z;
+		pool->staged_r[i] = r;
+		pool->is_staged[i] = true;
+		return;
+	}
+	rc_entity_internal_move(pool, i, x, y, z, r);
+	pool->previous_x[i] = x;
+	pool->previous_y[i] = y;
+	pool->previous_z[i] = z;
+	pool->previous_r[i] = r;
+}
+
+void rc_entity_get_transform(const struct rc_entity_pool *pool, struct rc_entity_handle entity, double *x, double *y, double *z, double *r) {
+	const int i = rc_entity_internal_get_dense_index(pool, entity);
+	*x = pool->x[i];
+	*y = pool->y[i];
+	*z = pool->z[i];
+	*r = pool->r[i];
+}
+
+// Blend between the transforms from the start and end of the last update, where alpha is 0 at the start and 1 at the end
+// Rotations are blended the short way round
+void rc_entity_get_interpolated_transform(const struct rc_entity_pool *pool, struct rc_entity_handle entity, double alpha, double *x, double *y, double *z, double *r) {
+	const int i = rc_entity_internal_get_dense_index(pool, entity);
+	*x = pool->previous_x[i] + (pool->x[i] - pool->previous_x[i]) * alpha;
+	*y = pool->previous_y[i] + (pool->y[i] - pool->previous_y[i]) * alpha;
+	*z = pool->previous_z[i] + (pool->z[i] - pool->previous_z[i]) * alpha;
+	*r = pool->previous_r[i] + remainder(pool->r[i] - pool->previous_r[i], 2 * PI) * alpha;
 }
 
 // TODO: entities should have an array of textures, each representing the entity from an angle
-const struct rc_texture *rc_entity_get_texture(const struct rc_entity *entity) {
-	return entity->texture;
+const struct rc_texture *rc_entity_get_texture(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	return pool->textures[rc_entity_internal_get_dense_index(pool, entity)];
+}
+
+int rc_entity_get_behavior(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	return pool->behaviors[rc_entity_internal_get_dense_index(pool, entity)];
+}
+
+// The entity takes ownership of the light, destroying any light it previously owned
+void rc_entity_set_light(struct rc_entity_pool *pool, struct rc_entity_handle entity, struct rc_light *light) {
+	RC_ASSERT(!pool->is_updating);
+	const int i = rc_entity_internal_get_dense_index(pool, entity);
+	if (pool->lights[i]) {
+		rc_map_remove_light(pool->map, pool->lights[i]);
+		rc_light_destroy(pool->lights[i]);
+	}
+	pool->lights[i] = light;
+	if (light) {
+		rc_light_set_position(light, floor(pool->x[i]), floor(pool->y[i]));
+		rc_map_add_light(pool->map, light);
+	}
+}
+
+struct rc_light *rc_entity_get_light(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	return pool->lights[rc_entity_internal_get_dense_index(pool, entity)];
+}
+
+// Entities with a radius of zero don't collide with anything
+void rc_entity_set_radius(struct rc_entity_pool *pool, struct rc_entity_handle entity, double radius) {
+	RC_ASSERT(!pool->is_updating && radius >= 0);
+	pool->radii[rc_entity_internal_get_dense_index(pool, entity)] = radius;
+	pool->max_radius = fmax(pool->max_radius, radius);
+}
+
+double rc_entity_get_radius(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	return pool->radii[rc_entity_internal_get_dense_index(pool, entity)];
+}
+
+// Whether the entity bumped into a wall or another entity when the last update was committed
+bool rc_entity_has_collided(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	return pool->has_collided[rc_entity_internal_get_dense_index(pool, entity)];
 }
 
-void rc_entity_set_data_pointer(struct rc_entity *entity, void *data_pointer) {
-	entity->data_pointer = data_pointer;
+// During an update, entities may only set their own data pointer
+void rc_entity_set_data_pointer(struct rc_entity_pool *pool, struct rc_entity_handle entity, void *data_pointer) {
+	const int i = rc_entity_internal_get_dense_index(pool, entity);
+	RC_ASSERT(!pool->is_updating || i == current_update_entity);
+	pool->data_pointers[i] = data_pointer;
 }
 
-void *rc_entity_get_data_pointer(const struct rc_entity *entity) {
-	return entity->data_pointer;
+void *rc_entity_get_data_pointer(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	return pool->data_pointers[rc_entity_internal_get_dense_index(pool, entity)];
 }
 
-void rc_entity_update(struct rc_entity *entity, struct rc_map *map) {
-	if (entity->update_function)
-		entity->update_function(entity, map);
+// Only committed entities have handles, so a spawn can't be despawned until its init function has seen its handle
+void rc_entity_despawn(struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	RC_ASSERT(rc_entity_is_alive(pool, entity));
+	struct rc_entity_queue *queue = rc_entity_internal_get_queue(pool);
+	if (queue->despawns_count == queue->despawns_capacity) {
+		queue->despawns_capacity = (queue->despawns_capacity) ? queue->despawns_capacity * 2 : 16;
+		queue->despawns = rc_entity_internal_resize_array(queue->despawns, sizeof *queue->despawns, queue->despawns_capacity);
+	}
+	queue->despawns[queue->despawns_count++] = entity;
 }
 
-void rc_entity_destroy(struct rc_entity *entity) {
+void rc_entity_destroy(struct rc_entity_pool *pool, struct rc_entity_handle entity) {
 	rc_log(RC_LOG_VERBOSE, "Destroying entity...");
-	if (entity->destroy_function)
-		entity->destroy_function(entity);
-	free(entity);
+	RC_ASSERT(!pool->is_updating && !pool->is_committing);
+	int i = rc_entity_internal_get_dense_index(pool, entity);
+	const int behavior = pool->behaviors[i];
+	if (behavior != RC_ENTITY_BEHAVIOR_NONE && pool->behavior_table[behavior].destroy_function) {
+		pool->behavior_table[behavior].destroy_function(pool, entity);
+		i = rc_entity_internal_get_dense_index(pool, entity);
+	}
+
+	rc_entity_internal_unlink_cell(pool, entity.index);
+	if (pool->lights[i]) {
+		rc_map_remove_light(pool->map, pool->lights[i]);
+		rc_light_destroy(pool->lights[i]);
+	}
+
+	// Keep the dense arrays packed by moving the last entity into the hole
+	const int last = --pool->count;
+	if (i != last) {
+		pool->x[i] = pool->x[last];
+		pool->y[i] = pool->y[last];
+		pool->z[i] = pool->z[last];
+		pool->r[i] = pool->r[last];
+		pool->previous_x[i] = pool->previous_x[last];
+		pool->previous_y[i] = pool->previous_y[last];
+		pool->previous_z[i] = pool->previous_z[last];
+		pool->previous_r[i] = pool->previous_r[last];
+		pool->textures[i] = pool->textures[last];
+		pool->behaviors[i] = pool->behaviors[last];
+		pool->data_pointers[i] = pool->data_pointers[last];
+		pool->lights[i] = pool->lights[last];
+		pool->radii[i] = pool->radii[last];
+		pool->has_collided[i] = pool->has_collided[last];
+		pool->staged_x[i] = pool->staged_x[last];
+		pool->staged_y[i] = pool->staged_y[last];
+		pool->staged_z[i] = pool->staged_z[last];
+		pool->staged_r[i] = pool->staged_r[last];
+		pool->is_staged[i] = pool->is_staged[last];
+		pool->dense_slots[i] = pool->dense_slots[last];
+		pool->slot_dense_indices[pool->dense_slots[i]] = i;
+	}
+
+	// Return the slot to the freelist - bumping the generation invalidates outstanding handles
+	pool->slot_generations[entity.index]++;
+	pool->slot_dense_indices[entity.index] = pool->free_slot;
+	pool->free_slot = entity.index;
+}
+
+static void rc_entity_internal_update_chunk(void *update_job, int chunk) {
+	const struct rc_entity_update_job *job = update_job;
+	struct rc_entity_pool *pool = job->pool;
+	const int first = chunk * RC_ENTITY_UPDATE_CHUNK_SIZE;
+	const int last = (first + RC_ENTITY_UPDATE_CHUNK_SIZE < pool->count) ? first + RC_ENTITY_UPDATE_CHUNK_SIZE : pool->count;
+	RC_PROFILE_BEGIN("entity update chunk");
+	current_update_chunk = chunk;
+	for (int i = first; i < last; i++) {
+		if (pool->behaviors[i] == RC_ENTITY_BEHAVIOR_NONE)
+			continue;
+		const entity_update_func update_function = pool->behavior_table[pool->behaviors[i]].update_function;
+		if (!update_function)
+			continue;
+		current_update_entity = i;
+		update_function(pool, rc_entity_internal_get_handle(pool, i), job->map);
+	}
+	current_update_chunk = -1;
+	current_update_entity = -1;
+	RC_PROFILE_END();
+}
+
+// Push apart overlapping pairs of entities found through the grid, then sweep them to their pushed positions so they
+// can't be forced into walls
+// Every push is found before any are applied, so the result doesn't depend on the order the pairs are visited in
+static void rc_entity_internal_resolve_collisions(struct rc_entity_pool *pool) {
+	if (pool->max_radius == 0)
+		return;
+	for (int i = 0; i < pool->count; i++)
+		pool->push_x[i] = pool->push_y[i] = 0;
+
+	for (int i = 0; i < pool->count; i++) {
+		if (pool->radii[i] == 0)
+			continue;
+		const double reach = pool->radii[i] + pool->max_radius;
+		const int first_cell_x = fmax(floor(pool->x[i] - reach), 0), last_cell_x = fmin(floor(pool->x[i] + reach), pool->grid_width - 1);
+		const int first_cell_y = fmax(floor(pool->y[i] - reach), 0), last_cell_y = fmin(floor(pool->y[i] + reach), pool->grid_height - 1);
+		for (int cell_y = first_cell_y; cell_y <= last_cell_y; cell_y++) {
+			for (int cell_x = first_cell_x; cell_x <= last_cell_x; cell_x++) {
+				for (int slot = pool->cell_heads[cell_y * pool->grid_width + cell_x]; slot != -1; slot = pool->slot_cell_next[slot]) {
+
+					// Each pair is only tested from its lower entity
+					const int j = pool->slot_dense_indices[slot];
+					if (j <= i || pool->radii[j] == 0)
+						continue;
+					const double offset_x = pool->x[j] - pool->x[i], offset_y = pool->y[j] - pool->y[i];
+					const double distance = sqrt(offset_x * offset_x + offset_y * offset_y);
+					const double overlap = pool->radii[i] + pool->radii[j] - distance;
+					if (overlap <= 0)
+						continue;
+
+					// Entities at the same position are separated along the x axis
+					const double normal_x = (distance > 0) ? offset_x / distance : 1;
+					const double normal_y = (distance > 0) ? offset_y / distance : 0;
+					pool->push_x[i] -= normal_x * overlap / 2;
+					pool->push_y[i] -= normal_y * overlap / 2;
+					pool->push_x[j] += normal_x * overlap / 2;
+					pool->push_y[j] += normal_y * overlap / 2;
+					pool->has_collided[i] = pool->has_collided[j] = true;
+				}
+			}
+		}
+	}
+
+	for (int i = 0; i < pool->count; i++) {
+		if (pool->push_x[i] == 0 && pool->push_y[i] == 0)
+			continue;
+		double x = pool->x[i], y = pool->y[i];
+		rc_collision_move_circle(pool->map, pool->radii[i], &x, &y, x + pool->push_x[i], y + pool->push_y[i]);
+		rc_entity_internal_move(pool, i, x, y, pool->z[i], pool->r[i]);
+	}
+}
+
+// Deferred changes go to the queue of the chunk being updated on this thread, if any
+static struct rc_entity_queue *rc_entity_internal_get_queue(struct rc_entity_pool *pool) {
+	if (pool->is_updating && current_update_chunk != -1)
+		return &pool->queues[current_update_chunk];
+	return &pool->external_queue;
+}
+
+static void rc_entity_internal_free_queue(struct rc_entity_queue *queue) {
+	free(queue->spawns);
+	free(queue->despawns);
+}
+
+// Take a slot from the freelist - it is not alive until an entity is inserted into it
+static int rc_entity_internal_reserve_slot(struct rc_entity_pool *pool) {
+	if (pool->free_slot == -1)
+		rc_entity_internal_grow(pool, pool->capacity * 2);
+	const int slot = pool->free_slot;
+	pool->free_slot = pool->slot_dense_indices[slot];
+	pool->slot_dense_indices[slot] = -1;
+	return slot;
+}
+
+// Append an entity to the dense arrays and link it to its slot
+static void rc_entity_internal_insert(struct rc_entity_pool *pool, int slot, double x, double y, double z, double r, const struct rc_texture *texture, int behavior) {
+	const int dense_index = pool->count++;
+	pool->slot_dense_indices[slot] = dense_index;
+	pool->dense_slots[dense_index] = slot;
+	pool->x[dense_index] = x;
+	pool->y[dense_index] = y;
+	pool->z[dense_index] = z;
+	pool->r[dense_index] = r;
+	pool->previous_x[dense_index] = x;
+	pool->previous_y[dense_index] = y;
+	pool->previous_z[dense_index] = z;
+	pool->previous_r[dense_index] = r;
+	pool->textures[dense_index] = texture;
+	pool->behaviors[dense_index] = behavior;
+	pool->data_pointers[dense_index] = NULL;
+	pool->lights[dense_index] = NULL;
+	pool->radii[dense_index] = 0;
+	pool->has_collided[dense_index] = false;
+	pool->is_staged[dense_index] = false;
+	rc_entity_internal_link_cell(pool, slot, rc_entity_internal_get_cell(pool, x, y));
+
+	const struct rc_entity_handle entity = { slot, pool->slot_generations[slot] };
+	if (behavior != RC_ENTITY_BEHAVIOR_NONE && pool->behavior_table[behavior].init_function)
+		pool->behavior_table[behavior].init_function(pool, entity);
+}
+
+static void rc_entity_internal_grow(struct rc_entity_pool *pool, int capacity) {
+	rc_log(RC_LOG_VERBOSE, "Growing entity pool to %i entities...", capacity);
+	pool->x = rc_entity_internal_resize_array(pool->x, sizeof *pool->x, capacity);
+	pool->y = rc_entity_internal_resize_array(pool->y, sizeof *pool->y, capacity);
+	pool->z = rc_entity_internal_resize_array(pool->z, sizeof *pool->z, capacity);
+	pool->r = rc_entity_internal_resize_array(pool->r, sizeof *pool->r, capacity);
+	pool->previous_x = rc_entity_internal_resize_array(pool->previous_x, sizeof *pool->previous_x, capacity);
+	pool->previous_y = rc_entity_internal_resize_array(pool->previous_y, sizeof *pool->previous_y, capacity);
+	pool->previous_z = rc_entity_internal_resize_array(pool->previous_z, sizeof *pool->previous_z, capacity);
+	pool->previous_r = rc_entity_internal_resize_array(pool->previous_r, sizeof *pool->previous_r, capacity);
+	pool->textures = rc_entity_internal_resize_array(pool->textures, sizeof *pool->textures, capacity);
+	pool->behaviors = rc_entity_internal_resize_array(pool->behaviors, sizeof *pool->behaviors, capacity);
+	pool->data_pointers = rc_entity_internal_resize_array(pool->data_pointers, sizeof *pool->data_pointers, capacity);
+	pool->lights = rc_entity_internal_resize_array(pool->lights, sizeof *pool->lights, capacity);
+	pool->radii = rc_entity_internal_resize_array(pool->radii, sizeof *pool->radii, capacity);
+	pool->has_collided = rc_entity_internal_resize_array(pool->has_collided, sizeof *pool->has_collided, capacity);
+	pool->push_x = rc_entity_internal_resize_array(pool->push_x, sizeof *pool->push_x, capacity);
+	pool->push_y = rc_entity_internal_resize_array(pool->push_y, sizeof *pool->push_y, capacity);
+	pool->dense_slots = rc_entity_internal_resize_array(pool->dense_slots, sizeof *pool->dense_slots, capacity);
+	pool->slot_generations = rc_entity_internal_resize_array(pool->slot_generations, sizeof *pool->slot_generations, capacity);
+	pool->slot_dense_indices = rc_entity_internal_resize_array(pool->slot_dense_indices, sizeof *pool->slot_dense_indices, capacity);
+	pool->staged_x = rc_entity_internal_resize_array(pool->staged_x, sizeof *pool->staged_x, capacity);
+	pool->staged_y = rc_entity_internal_resize_array(pool->staged_y, sizeof *pool->staged_y, capacity);
+	pool->staged_z = rc_entity_internal_resize_array(pool->staged_z, sizeof *pool->staged_z, capacity);
+	pool->staged_r = rc_entity_internal_resize_array(pool->staged_r, sizeof *pool->staged_r, capacity);
+	pool->is_staged = rc_entity_internal_resize_array(pool->is_staged, sizeof *pool->is_staged, capacity);
+	pool->slot_cells = rc_entity_internal_resize_array(pool->slot_cells, sizeof *pool->slot_cells, capacity);
+	pool->slot_cell_next = rc_entity_internal_resize_array(pool->slot_cell_next, sizeof *pool->slot_cell_next, capacity);
+	pool->slot_cell_prev = rc_entity_internal_resize_array(pool->slot_cell_prev, sizeof *pool->slot_cell_prev, capacity);
+
+	// Push the new slots onto the freelist so the lowest slots are used first
+	for (int slot = capacity - 1; slot >= pool->capacity; slot--) {
+		pool->slot_generations[slot] = 0;
+		pool->slot_dense_indices[slot] = pool->free_slot;
+		pool->free_slot = slot;
+	}
+	pool->capacity = capacity;
+}
+
+static void *rc_entity_internal_resize_array(void *array, size_t element_size, int capacity) {
+	void *new_array = realloc(array, element_size * capacity);
+	RC_ASSERT(new_array);
+	return new_array;
+}
+
+// Move an entity and everything that follows it
+static void rc_entity_internal_move(struct rc_entity_pool *pool, int dense_index, double x, double y, double z, double r) {
+	const int slot = pool->dense_slots[dense_index];
+	pool->x[dense_index] = x;
+	pool->y[dense_index] = y;
+	pool->z[dense_index] = z;
+	pool->r[dense_index] = r;
+	if (pool->lights[dense_index])
+		rc_light_set_position(pool->lights[dense_index], floor(x), floor(y));
+
+	// Move the entity between grid cells only when it crosses a tile boundary
+	const int cell = rc_entity_internal_get_cell(pool, x, y);
+	if (cell != pool->slot_cells[slot]) {
+		rc_entity_internal_unlink_cell(pool, slot);
+		rc_entity_internal_link_cell(pool, slot, cell);
+	}
+}
+
+// Entities outside the map are kept in the nearest edge cell
+static int rc_entity_internal_get_cell(const struct rc_entity_pool *pool, double x, double y) {
+	const int cell_x = fmin(fmax(floor(x), 0), pool->grid_width - 1);
+	const int cell_y = fmin(fmax(floor(y), 0), pool->grid_height - 1);
+	return cell_y * pool->grid_width + cell_x;
+}
+
+static void rc_entity_internal_link_cell(struct rc_entity_pool *pool, int slot, int cell) {
+	const int head = pool->cell_heads[cell];
+	pool->slot_cells[slot] = cell;
+	pool->slot_cell_prev[slot] = -1;
+	pool->slot_cell_next[slot] = head;
+	if (head != -1)
+		pool->slot_cell_prev[head] = slot;
+	pool->cell_heads[cell] = slot;
+}
+
+static void rc_entity_internal_unlink_cell(struct rc_entity_pool *pool, int slot) {
+	const int prev = pool->slot_cell_prev[slot], next = pool->slot_cell_next[slot];
+	if (prev != -1)
+		pool->slot_cell_next[prev] = next;
+	else
+		pool->cell_heads[pool->slot_cells[slot]] = next;
+	if (next != -1)
+		pool->slot_cell_prev[next] = prev;
+}
+
+static int rc_entity_internal_get_dense_index(const struct rc_entity_pool *pool, struct rc_entity_handle entity) {
+	RC_ASSERT(rc_entity_is_alive(pool, entity));
+	return pool->slot_dense_indices[entity.index];
+}
+
+static struct rc_entity_handle rc_entity_internal_get_handle(const struct rc_entity_pool *pool, int dense_index) {
+	const int slot = pool->dense_slots[dense_index];
+	return (struct rc_entity_handle) { slot, pool->slot_generations[slot] };
 }
@@ -1,21 +1,57 @@
 #ifndef RC_ENTITY_H
 #define RC_ENTITY_H
 
+#include <stdbool.h>
+
+#define RC_ENTITY_BEHAVIOR_NONE -1
+#define RC_ENTITY_HANDLE_NONE ((struct rc_entity_handle) { -1, 0 })
+
 struct rc_texture;
+struct rc_light;
 struct rc_map;
-struct rc_entity;
-
-typedef void (*entity_init_func)(struct rc_entity *entity);
-typedef void (*entity_update_func)(struct rc_entity *entity, struct rc_map *map);
-typedef void (*entity_destroy_func)(struct rc_entity *entity);
-
-struct rc_entity *rc_entity_create(double x, double y, double z, double r, const struct rc_texture *texture, entity_init_func init_function, entity_update_func update_function, entity_destroy_func destroy_function);
-void rc_entity_set_transform(struct rc_entity *entity, double x, double y, double z, double r);
-void rc_entity_get_transform(const struct rc_entity *entity, double *x, double *y, double *z, double *r);
-const struct rc_texture *rc_entity_get_texture(const struct rc_entity *entity);
-void rc_entity_set_data_pointer(struct rc_entity *entity, void *data_pointer);
-void *rc_entity_get_data_pointer(const struct rc_entity *entity);
-void rc_entity_update(struct rc_entity *entity, struct rc_map *map);
-void rc_entity_destroy(struct rc_entity *entity);
+struct rc_entity_pool;
+struct rc_job_system;
+
+// Stable reference to an entity in a pool - the generation catches handles to destroyed entities whose slot was reused
+struct rc_entity_handle {
+	int index;
+	unsigned generation;
+};
+
+typedef void (*entity_init_func)(struct rc_entity_pool *pool, struct rc_entity_handle entity);
+// Update functions may run on any thread, so they only read the map and may only change their own entity
+// Changes to anything else must be deferred by spawning or despawning
+typedef void (*entity_update_func)(struct rc_entity_pool *pool, struct rc_entity_handle entity, const struct rc_map *map);
+typedef void (*entity_destroy_func)(struct rc_entity_pool *pool, struct rc_entity_handle entity);
+
+struct rc_entity_pool *rc_entity_pool_create(int initial_capacity, struct rc_map *map);
+int rc_entity_pool_add_behavior(struct rc_entity_pool *pool, entity_init_func init_function, entity_update_func update_function, entity_destroy_func destroy_function);
+int rc_entity_pool_get_count(const struct rc_entity_pool *pool);
+void rc_entity_pool_get_transforms(const struct rc_entity_pool *pool, const double **x, const double **y, const double **z, const double **r);
+void rc_entity_pool_get_previous_transforms(const struct rc_entity_pool *pool, const double **x, const double **y, const double **z, const double **r);
+const struct rc_texture *const *rc_entity_pool_get_textures(const struct rc_entity_pool *pool);
+int rc_entity_pool_query_radius(const struct rc_entity_pool *pool, double x, double y, double radius, struct rc_entity_handle *results, int max_results);
+int rc_entity_pool_query_frustum(const struct rc_entity_pool *pool, double x, double y, double r, double fov, double range, double margin, int *results, int max_results);
+void rc_entity_pool_update(struct rc_entity_pool *pool, const struct rc_map *map, struct rc_job_system *jobs);
+void rc_entity_pool_commit(struct rc_entity_pool *pool);
+void rc_entity_pool_destroy(struct rc_entity_pool *pool);
+
+struct rc_entity_handle rc_entity_create(struct rc_entity_pool *pool, double x, double y, double z, double r, const struct rc_texture *texture, int behavior);
+void rc_entity_spawn(struct rc_entity_pool *pool, double x, double y, double z, double r, const struct rc_texture *texture, int behavior);
+void rc_entity_despawn(struct rc_entity_pool *pool, struct rc_entity_handle entity);
+bool rc_entity_is_alive(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+void rc_entity_set_transform(struct rc_entity_pool *pool, struct rc_entity_handle entity, double x, double y, double z, double r);
+void rc_entity_get_transform(const struct rc_entity_pool *pool, struct rc_entity_handle entity, double *x, double *y, double *z, double *r);
+void rc_entity_get_interpolated_transform(const struct rc_entity_pool *pool, struct rc_entity_handle entity, double alpha, double *x, double *y, double *z, double *r);
+const struct rc_texture *rc_entity_get_texture(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+int rc_entity_get_behavior(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+void rc_entity_set_light(struct rc_entity_pool *pool, struct rc_entity_handle entity, struct rc_light *light);
+struct rc_light *rc_entity_get_light(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+void rc_entity_set_radius(struct rc_entity_pool *pool, struct rc_entity_handle entity, double radius);
+double rc_entity_get_radius(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+bool rc_entity_has_collided(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+void rc_entity_set_data_pointer(struct rc_entity_pool *pool, struct rc_entity_handle entity, void *data_pointer);
+void *rc_entity_get_data_pointer(const struct rc_entity_pool *pool, struct rc_entity_handle entity);
+void rc_entity_destroy(struct rc_entity_pool *pool, struct rc_entity_handle entity);
 
 #endif
@@ -8,5 +8,6 @@ void rc_error(const char *message, ...) {
 	va_start(args, message);
 	rc_log_variadic(RC_LOG_ERROR, message, args);
 	va_end(args);
+	rc_log_flush();
 	exit(1);
 }
@@ -1,7 +1,19 @@
 #include "input.h"
+#include "logging.h"
+#include "error.h"
+#include <stdio.h>
+#include <string.h>
 
 #define mouse_sensitivity 0.05
 
+// Recordings are a header followed by one record for every tick:
+// the number of keys and buttons which changed, each as an input index and whether it was pressed, then the mouse velocity
+// Buttons are indexed after the keys, and the mouse velocity is two little-endian 16-bit integers
+#define RC_INPUT_RECORDING_MAGIC "RCIN"
+#define RC_INPUT_RECORDING_VERSION 1
+#define RC_INPUT_RECORDING_HEADER_SIZE 8
+#define RC_INPUT_RECORDING_MAX_RECORD_SIZE (1 + 2 * (rc_input_key_count + rc_input_button_count) + 4)
+
 enum rc_input_state {
 	RC_INPUT_STATE_UNPRESSED,
 	RC_INPUT_STATE_PRESSED,
@@ -13,6 +25,10 @@ static int mouse_x, mouse_y;
 static int mouse_vx, mouse_vy;
 static enum rc_input_state keys[rc_input_key_count];
 static enum rc_input_state buttons[rc_input_button_count];
+static FILE *recording_file, *replay_file;
+
+static void rc_input_internal_write_velocity(unsigned char *bytes, int velocity);
+static int rc_input_internal_read_velocity(const unsigned char *bytes);
 
 void rc_input_update(void) {
 	for (int i = 0; i < rc_input_key_count; i++) {
@@ -72,3 +88,118 @@ void rc_input_set_mouse_position(int x, int y) {
 	mouse_x = x;
 	mouse_y = y;
 }
+
+bool rc_input_start_recording(const char *filename) {
+	rc_log(RC_LOG_INFO, "Recording input to '%s'...", filename);
+	RC_ASSERT(!recording_file);
+	recording_file = fopen(filename, "wb");
+	if (!recording_file) {
+		rc_log(RC_LOG_WARN, "Could not open '%s' to record input to!", filename);
+		return false;
+	}
+	unsigned char header[RC_INPUT_RECORDING_HEADER_SIZE] = { 0 };
+	memcpy(header, RC_INPUT_RECORDING_MAGIC, 4);
+	header[4] = RC_INPUT_RECORDING_VERSION;
+	fwrite(header, 1, sizeof header, recording_file);
+	return true;
+}
+
+// Record the input delivered for this tick - call this before anything reads the input
+// Keys and buttons which are pressed or released must have changed this tick, held and unpressed ones follow from the last tick
+void rc_input_record_tick(void) {
+	if (!recording_file)
+		return;
+	unsigned char record[RC_INPUT_RECORDING_MAX_RECORD_SIZE];
+	int changes_count = 0;
+	for (int i = 0; i < rc_input_key_count + rc_input_button_count; i++) {
+		const enum rc_input_state state = (i < rc_input_key_count) ? keys[i] : buttons[i - rc_input_key_count];
+		if (state != RC_INPUT_STATE_PRESSED && state != RC_INPUT_STATE_RELEASED)
+			continue;
+		record[1 + 2 * changes_count] = i;
+		record[2 + 2 * changes_count] = state == RC_INPUT_STATE_PRESSED;
+		changes_count++;
+	}
+	record[0] = changes_count;
+	rc_input_internal_write_velocity(&record[1 + 2 * changes_count], mouse_vx);
+	rc_input_internal_write_velocity(&record[3 + 2 * changes_count], mouse_vy);
+	const int record_size = 5 + 2 * changes_count;
+	if (fwrite(record, 1, record_size, recording_file) != record_size) {
+		rc_log(RC_LOG_WARN, "Could not write input recording, stopping recording!");
+		rc_input_stop_recording();
+	}
+}
+
+void rc_input_stop_recording(void) {
+	if (!recording_file)
+		return;
+	rc_log(RC_LOG_INFO, "Stopping input recording...");
+	fclose(recording_file);
+	recording_file = NULL;
+}
+
+bool rc_input_start_replay(const char *filename) {
+	rc_log(RC_LOG_INFO, "Replaying input from '%s'...", filename);
+	RC_ASSERT(!replay_file);
+	replay_file = fopen(filename, "rb");
+	if (!replay_file) {
+		rc_log(RC_LOG_WARN, "Could not open input recording '%s'!", filename);
+		return false;
+	}
+	unsigned char header[RC_INPUT_RECORDING_HEADER_SIZE];
+	if (fread(header, 1, sizeof header, replay_file) != sizeof header || memcmp(header, RC_INPUT_RECORDING_MAGIC, 4) || header[4] != RC_INPUT_RECORDING_VERSION) {
+		rc_log(RC_LOG_WARN, "'%s' is not a valid input recording!", filename);
+		rc_input_stop_replay();
+		return false;
+	}
+	return true;
+}
+
+// Feed the next tick of the recording through the same setters the window uses
+// Returns false once the whole recording has been replayed
+bool rc_input_replay_tick(void) {
+	if (!replay_file)
+		return false;
+	const int changes_count = fgetc(replay_file);
+	if (changes_count == EOF) {
+		rc_input_stop_replay();
+		return false;
+	}
+
+	unsigned char record[RC_INPUT_RECORDING_MAX_RECORD_SIZE];
+	const int record_size = 2 * changes_count + 4;
+	if (changes_count > rc_input_key_count + rc_input_button_count || fread(record, 1, record_size, replay_file) != record_size) {
+		rc_log(RC_LOG_WARN, "Input recording is corrupted, stopping replay!");
+		rc_input_stop_replay();
+		return false;
+	}
+	for (int i = 0; i < changes_count; i++) {
+		const int index = record[2 * i];
+		const bool state = record[2 * i + 1];
+		if (index < rc_input_key_count)
+			rc_input_set_keyboard_input(index, state);
+		else if (index < rc_input_key_count + rc_input_button_count)
+			rc_input_set_mouse_input(index - rc_input_key_count, state);
+	}
+	rc_input_set_mouse_position(mouse_x + rc_input_internal_read_velocity(&record[2 * changes_count]), mouse_y + rc_input_internal_read_velocity(&record[2 * changes_count + 2]));
+	return true;
+}
+
+void rc_input_stop_replay(void) {
+	if (!replay_file)
+		return;
+	rc_log(RC_LOG_INFO, "Stopping input replay...");
+	fclose(replay_file);
+	replay_file = NULL;
+}
+
+static void rc_input_internal_write_velocity(unsigned char *bytes, int velocity) {
+	if (velocity < -32768) velocity = -32768;
+	if (velocity > 32767) velocity = 32767;
+	bytes[0] = velocity & 0xff;
+	bytes[1] = (velocity >> 8) & 0xff;
+}
+
+static int rc_input_internal_read_velocity(const unsigned char *bytes) {
+	const int velocity = bytes[0] | bytes[1] << 8;
+	return (velocity > 32767) ? velocity - 65536 : velocity;
+}
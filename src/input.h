@@ -66,5 +66,11 @@ void rc_input_get_mouse_velocity(double *vx, double *vy);
 void rc_input_set_keyboard_input(enum rc_input_key key, bool state);
 void rc_input_set_mouse_input(enum rc_input_button button, bool state);
 void rc_input_set_mouse_position(int x, int y);
+bool rc_input_start_recording(const char *filename);
+void rc_input_record_tick(void);
+void rc_input_stop_recording(void);
+bool rc_input_start_replay(const char *filename);
+bool rc_input_replay_tick(void);
+void rc_input_stop_replay(void);
 
 #endif
@@ -0,0 +1,241 @@
+#include "jobs.h"
+#include "logging.h"
+#include "error.h"
+#include "platform.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Workers use pthreads on Linux and Win32 threads on Windows, behind the same few operations
+#ifdef RC_LINUX
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t rc_job_system_thread;
+typedef pthread_mutex_t rc_job_system_mutex;
+typedef pthread_cond_t rc_job_system_condition;
+#define RC_JOB_SYSTEM_LOCK(mutex) pthread_mutex_lock(mutex)
+#define RC_JOB_SYSTEM_UNLOCK(mutex) pthread_mutex_unlock(mutex)
+#define RC_JOB_SYSTEM_WAIT(condition, mutex) pthread_cond_wait(condition, mutex)
+#define RC_JOB_SYSTEM_SIGNAL(condition) pthread_cond_signal(condition)
+#define RC_JOB_SYSTEM_BROADCAST(condition) pthread_cond_broadcast(condition)
+#elif defined RC_WINDOWS
+#include <windows.h>
+typedef HANDLE rc_job_system_thread;
+typedef CRITICAL_SECTION rc_job_system_mutex;
+typedef CONDITION_VARIABLE rc_job_system_condition;
+#define RC_JOB_SYSTEM_LOCK(mutex) EnterCriticalSection(mutex)
+#define RC_JOB_SYSTEM_UNLOCK(mutex) LeaveCriticalSection(mutex)
+#define RC_JOB_SYSTEM_WAIT(condition, mutex) SleepConditionVariableCS(condition, mutex, INFINITE)
+#define RC_JOB_SYSTEM_SIGNAL(condition) WakeConditionVariable(condition)
+#define RC_JOB_SYSTEM_BROADCAST(condition) WakeAllConditionVariable(condition)
+#endif
+
+// Jobs are handed out in batches - every thread (including the caller) takes job indices from the batch until
+// none are left, and the caller returns once all of them are finished
+// A batch can also be started in the background, the caller then joins in when it waits for the batch
+
+struct rc_job_system {
+	int threads_count;
+	bool is_batch_started;
+	rc_job_system_thread *threads;
+	rc_job_system_mutex mutex;
+	rc_job_system_condition batch_started, batch_finished;
+	bool is_shutting_down;
+	unsigned batch_generation;
+	int active_workers;
+	job_func function;
+	void *data;
+	int jobs_count;
+	atomic_int next_job, finished_jobs;
+};
+
+#ifdef RC_LINUX
+static void *rc_job_system_internal_start_worker(void *jobs);
+#elif defined RC_WINDOWS
+static DWORD WINAPI rc_job_system_internal_start_worker(LPVOID jobs);
+#endif
+static void rc_job_system_internal_worker(struct rc_job_system *jobs);
+static void rc_job_system_internal_work(struct rc_job_system *jobs, job_func function, void *data, int jobs_count);
+
+struct rc_job_system *rc_job_system_create(int threads_count) {
+	rc_log(RC_LOG_VERBOSE, "Creating new job system...");
+	struct rc_job_system *jobs = calloc(1, sizeof *jobs);
+	RC_ASSERT(jobs);
+
+	// Use a thread for every core if no thread count is specified
+	if (threads_count <= 0) {
+#ifdef RC_LINUX
+		threads_count = sysconf(_SC_NPROCESSORS_ONLN);
+#elif defined RC_WINDOWS
+		SYSTEM_INFO system_info;
+		GetSystemInfo(&system_info);
+		threads_count = system_info.dwNumberOfProcessors;
+#endif
+	}
+	if (threads_count <= 0)
+		threads_count = 1;
+	jobs->threads_count = threads_count;
+	rc_log(RC_LOG_INFO, "Starting job system with %i threads...", threads_count);
+
+	// The calling thread is one of the threads, so only start the rest
+#ifdef RC_LINUX
+	pthread_mutex_init(&jobs->mutex, NULL);
+	pthread_cond_init(&jobs->batch_started, NULL);
+	pthread_cond_init(&jobs->batch_finished, NULL);
+#elif defined RC_WINDOWS
+	InitializeCriticalSection(&jobs->mutex);
+	InitializeConditionVariable(&jobs->batch_started);
+	InitializeConditionVariable(&jobs->batch_finished);
+#endif
+	jobs->threads = malloc(sizeof *jobs->threads * threads_count);
+	RC_ASSERT(jobs->threads);
+	for (int i = 1; i < threads_count; i++) {
+#ifdef RC_LINUX
+		const bool is_started = !pthread_create(&jobs->threads[i], NULL, rc_job_system_internal_start_worker, jobs);
+#elif defined RC_WINDOWS
+		jobs->threads[i] = CreateThread(NULL, 0, rc_job_system_internal_start_worker, jobs, 0, NULL);
+		const bool is_started = jobs->threads[i] != NULL;
+#endif
+		if (!is_started)
+			rc_error("Unable to start job system thread!");
+	}
+
+	return jobs;
+}
+
+int rc_job_system_get_threads_count(const struct rc_job_system *jobs) {
+	return jobs->threads_count;
+}
+
+void rc_job_system_run(struct rc_job_system *jobs, job_func function, void *data, int jobs_count) {
+	RC_ASSERT(!jobs->is_batch_started);
+	if (jobs_count <= 0)
+		return;
+
+	// Small batches aren't worth waking the workers for
+	if (jobs->threads_count > 1 && jobs_count > 1) {
+		rc_job_system_start(jobs, function, data, jobs_count);
+		rc_job_system_wait(jobs);
+		return;
+	}
+
+	for (int i = 0; i < jobs_count; i++)
+		function(data, i);
+}
+
+// Hand a batch to the workers and return immediately - the batch must be waited for before another can be started
+// Without workers the batch is run before returning
+void rc_job_system_start(struct rc_job_system *jobs, job_func function, void *data, int jobs_count) {
+	RC_ASSERT(!jobs->is_batch_started);
+	if (jobs_count <= 0)
+		return;
+
+	if (jobs->threads_count > 1) {
+		RC_JOB_SYSTEM_LOCK(&jobs->mutex);
+		while (jobs->active_workers > 0)
+			RC_JOB_SYSTEM_WAIT(&jobs->batch_finished, &jobs->mutex);
+		jobs->function = function;
+		jobs->data = data;
+		jobs->jobs_count = jobs_count;
+		atomic_store(&jobs->next_job, 0);
+		atomic_store(&jobs->finished_jobs, 0);
+		jobs->batch_generation++;
+		jobs->is_batch_started = true;
+		RC_JOB_SYSTEM_BROADCAST(&jobs->batch_started);
+		RC_JOB_SYSTEM_UNLOCK(&jobs->mutex);
+		return;
+	}
+
+	for (int i = 0; i < jobs_count; i++)
+		function(data, i);
+}
+
+// Help finish the started batch, if any, and return once all of its jobs are done
+void rc_job_system_wait(struct rc_job_system *jobs) {
+	if (!jobs->is_batch_started)
+		return;
+
+	rc_job_system_internal_work(jobs, jobs->function, jobs->data, jobs->jobs_count);
+
+	// Workers still holding this batch must also be finished before the next batch can be started
+	RC_JOB_SYSTEM_LOCK(&jobs->mutex);
+	while (atomic_load(&jobs->finished_jobs) < jobs->jobs_count || jobs->active_workers > 0)
+		RC_JOB_SYSTEM_WAIT(&jobs->batch_finished, &jobs->mutex);
+	jobs->function = NULL;
+	jobs->is_batch_started = false;
+	RC_JOB_SYSTEM_UNLOCK(&jobs->mutex);
+}
+
+void rc_job_system_destroy(struct rc_job_system *jobs) {
+	rc_log(RC_LOG_VERBOSE, "Destroying job system...");
+	rc_job_system_wait(jobs);
+	RC_JOB_SYSTEM_LOCK(&jobs->mutex);
+	jobs->is_shutting_down = true;
+	RC_JOB_SYSTEM_BROADCAST(&jobs->batch_started);
+	RC_JOB_SYSTEM_UNLOCK(&jobs->mutex);
+#ifdef RC_LINUX
+	for (int i = 1; i < jobs->threads_count; i++)
+		pthread_join(jobs->threads[i], NULL);
+	pthread_cond_destroy(&jobs->batch_started);
+	pthread_cond_destroy(&jobs->batch_finished);
+	pthread_mutex_destroy(&jobs->mutex);
+#elif defined RC_WINDOWS
+	for (int i = 1; i < jobs->threads_count; i++) {
+		WaitForSingleObject(jobs->threads[i], INFINITE);
+		CloseHandle(jobs->threads[i]);
+	}
+	DeleteCriticalSection(&jobs->mutex);
+#endif
+	free(jobs->threads);
+	free(jobs);
+}
+
+#ifdef RC_LINUX
+static void *rc_job_system_internal_start_worker(void *jobs) {
+	rc_job_system_internal_worker(jobs);
+	return NULL;
+}
+#elif defined RC_WINDOWS
+static DWORD WINAPI rc_job_system_internal_start_worker(LPVOID jobs) {
+	rc_job_system_internal_worker(jobs);
+	return 0;
+}
+#endif
+
+static void rc_job_system_internal_worker(struct rc_job_system *jobs) {
+	unsigned seen_generation = 0;
+	RC_JOB_SYSTEM_LOCK(&jobs->mutex);
+	while (true) {
+		while (!jobs->is_shutting_down && jobs->batch_generation == seen_generation)
+			RC_JOB_SYSTEM_WAIT(&jobs->batch_started, &jobs->mutex);
+		if (jobs->is_shutting_down)
+			break;
+		seen_generation = jobs->batch_generation;
+		const job_func function = jobs->function;
+		void *batch_data = jobs->data;
+		const int jobs_count = jobs->jobs_count;
+		jobs->active_workers++;
+		RC_JOB_SYSTEM_UNLOCK(&jobs->mutex);
+
+		rc_job_system_internal_work(jobs, function, batch_data, jobs_count);
+
+		RC_JOB_SYSTEM_LOCK(&jobs->mutex);
+		if (--jobs->active_workers == 0)
+			RC_JOB_SYSTEM_SIGNAL(&jobs->batch_finished);
+	}
+	RC_JOB_SYSTEM_UNLOCK(&jobs->mutex);
+}
+
+static void rc_job_system_internal_work(struct rc_job_system *jobs, job_func function, void *data, int jobs_count) {
+
+	// Take jobs until there are none left, the last thread to finish a job wakes the caller
+	int job_index;
+	while ((job_index = atomic_fetch_add(&jobs->next_job, 1)) < jobs_count) {
+		function(data, job_index);
+		if (atomic_fetch_add(&jobs->finished_jobs, 1) + 1 == jobs_count) {
+			RC_JOB_SYSTEM_LOCK(&jobs->mutex);
+			RC_JOB_SYSTEM_SIGNAL(&jobs->batch_finished);
+			RC_JOB_SYSTEM_UNLOCK(&jobs->mutex);
+		}
+	}
+}
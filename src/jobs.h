@@ -0,0 +1,15 @@
+#ifndef RC_JOBS_H
+#define RC_JOBS_H
+
+struct rc_job_system;
+
+typedef void (*job_func)(void *data, int job_index);
+
+struct rc_job_system *rc_job_system_create(int threads_count);
+int rc_job_system_get_threads_count(const struct rc_job_system *jobs);
+void rc_job_system_run(struct rc_job_system *jobs, job_func function, void *data, int jobs_count);
+void rc_job_system_start(struct rc_job_system *jobs, job_func function, void *data, int jobs_count);
+void rc_job_system_wait(struct rc_job_system *jobs);
+void rc_job_system_destroy(struct rc_job_system *jobs);
+
+#endif
@@ -0,0 +1,119 @@
+#include "kernels.h"
+#include "logging.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdint.h>
+
+// The wider instruction sets are only built where GCC can target them function by function
+#if (defined __GNUC__ && !defined __clang__ && (defined __x86_64__ || defined __i386__))
+#define RC_KERNELS_X86
+#endif
+
+// Transposed frames are copied in blocks of this many pixels square - 16 RGBA pixels fill a cache line
+#define RC_KERNELS_TRANSPOSE_BLOCK_SIZE 16
+
+// Sized span kernels step through textures in fixed point with 16 bits below the texel
+#define RC_KERNELS_FIXED_POINT_ONE (1 << 16)
+
+static const char *RC_KERNELS_ISA_NAMES[rc_kernels_isa_count] = { "generic", "avx2", "avx512" };
+static const int RC_KERNELS_SPAN_SIZES[RC_KERNELS_SPAN_SIZES_COUNT] = { 32, 64, 128, 256 };
+
+#define RC_KERNELS_VARIANT(name) name##_generic
+#include "kernels_variant.h"
+#undef RC_KERNELS_VARIANT
+
+// Wider sets must round exactly like the generic kernels, so multiplies and adds are never fused
+#ifdef RC_KERNELS_X86
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,bmi2")
+#pragma GCC optimize("fp-contract=off")
+#define RC_KERNELS_VARIANT(name) name##_avx2
+#include "kernels_variant.h"
+#undef RC_KERNELS_VARIANT
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vl,avx2,fma,bmi2")
+#pragma GCC optimize("fp-contract=off")
+#define RC_KERNELS_VARIANT(name) name##_avx512
+#include "kernels_variant.h"
+#undef RC_KERNELS_VARIANT
+#pragma GCC pop_options
+#endif
+
+static const struct rc_kernels *RC_KERNELS_ISA_KERNELS[rc_kernels_isa_count] = {
+	&rc_kernels_internal_kernels_generic,
+#ifdef RC_KERNELS_X86
+	&rc_kernels_internal_kernels_avx2,
+	&rc_kernels_internal_kernels_avx512
+#endif
+};
+
+// Kernels can be used before initialization, they just won't be the fastest ones
+static enum rc_kernels_isa current_isa = RC_KERNELS_ISA_GENERIC;
+
+static bool rc_kernels_internal_is_supported(enum rc_kernels_isa isa);
+
+// Set RC_KERNELS to an instruction set name to use it instead of the best supported one
+void rc_kernels_init(void) {
+	rc_log(RC_LOG_INFO, "Selecting render kernels...");
+	current_isa = RC_KERNELS_ISA_GENERIC;
+	for (int i = 0; i < rc_kernels_isa_count; i++)
+		if (rc_kernels_internal_is_supported(i))
+			current_isa = i;
+
+	const char *requested_isa_name = getenv("RC_KERNELS");
+	if (requested_isa_name && *requested_isa_name) {
+		int requested_isa = 0;
+		while (requested_isa < rc_kernels_isa_count && strcmp(requested_isa_name, RC_KERNELS_ISA_NAMES[requested_isa]))
+			requested_isa++;
+		if (requested_isa == rc_kernels_isa_count)
+			rc_log(RC_LOG_WARN, "Unrecognized render kernels '%s'!", requested_isa_name);
+		else if (!rc_kernels_internal_is_supported(requested_isa))
+			rc_log(RC_LOG_WARN, "Render kernels '%s' aren't supported by this CPU!", requested_isa_name);
+		else
+			current_isa = requested_isa;
+	}
+
+	rc_log(RC_LOG_VERBOSE, "Using %s render kernels.", RC_KERNELS_ISA_NAMES[current_isa]);
+}
+
+enum rc_kernels_isa rc_kernels_get_isa(void) {
+	return current_isa;
+}
+
+const char *rc_kernels_get_isa_name(enum rc_kernels_isa isa) {
+	return RC_KERNELS_ISA_NAMES[isa];
+}
+
+const struct rc_kernels *rc_kernels_get(void) {
+	return RC_KERNELS_ISA_KERNELS[current_isa];
+}
+
+// Chosen per texture - textures without a specialized size use the generic spans
+const struct rc_kernels_spans *rc_kernels_get_spans(int tex_width, int tex_height) {
+	const struct rc_kernels *kernels = RC_KERNELS_ISA_KERNELS[current_isa];
+	for (int i = 0; i < RC_KERNELS_SPAN_SIZES_COUNT && tex_width == tex_height; i++)
+		if (tex_width == RC_KERNELS_SPAN_SIZES[i])
+			return &kernels->sized_spans[i];
+	return &kernels->spans;
+}
+
+// CPUID reports the instruction sets, and the builtins also check that the OS saves the wider registers
+static bool rc_kernels_internal_is_supported(enum rc_kernels_isa isa) {
+	switch (isa) {
+		case RC_KERNELS_ISA_GENERIC:
+			return true;
+#ifdef RC_KERNELS_X86
+		case RC_KERNELS_ISA_AVX2:
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2");
+		case RC_KERNELS_ISA_AVX512:
+			__builtin_cpu_init();
+			return rc_kernels_internal_is_supported(RC_KERNELS_ISA_AVX2) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl");
+#endif
+		default:
+			return false;
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef RC_KERNELS_H
+#define RC_KERNELS_H
+
+#include <stdint.h>
+
+// The innermost loops of the renderer and lighting, compiled for several instruction sets
+// The best set the CPU supports is chosen once at startup, unless overridden with the RC_KERNELS environment variable
+
+enum rc_kernels_isa {
+	RC_KERNELS_ISA_GENERIC = 0,
+	RC_KERNELS_ISA_AVX2,
+	RC_KERNELS_ISA_AVX512,
+	rc_kernels_isa_count
+};
+
+// Span kernels are also built for square textures of 32, 64, 128 and 256 texels, which step through rows in fixed point and wrap them with a mask
+#define RC_KERNELS_SPAN_SIZES_COUNT 4
+
+// Pixels and texels are RGBA, and strides are in pixels, texels or indices rather than bytes
+// Lights are RGBA too, so a light with full alpha leaves the alpha of the color untouched
+struct rc_kernels_spans {
+	void (*draw_wall_span)(unsigned char *pixels, int pixels_stride, const unsigned char *texels, int texels_stride, double tex_y, double texels_per_row, const unsigned char *light, int count);
+	void (*draw_palettized_wall_span)(unsigned char *pixels, int pixels_stride, const unsigned char *indices, int indices_stride, double tex_y, double texels_per_row, const unsigned char *lit_palette, int count);
+	void (*draw_sprite_span)(unsigned char *pixels, int pixels_stride, const unsigned char *texels, int texels_stride, int tex_height, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *light, int count);
+	void (*draw_palettized_sprite_span)(unsigned char *pixels, int pixels_stride, const unsigned char *indices, int indices_stride, int tex_height, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *lit_palette, int count);
+};
+
+struct rc_kernels {
+	void (*light_span)(unsigned char *pixels, int pixels_stride, const unsigned char *colors, const unsigned char *lights, int count);
+	void (*light_palette)(unsigned char *lit_palette, const unsigned char *palette, const unsigned char *light, int colors_count);
+	struct rc_kernels_spans spans;
+	struct rc_kernels_spans sized_spans[RC_KERNELS_SPAN_SIZES_COUNT];
+	void (*fill_lighting)(uint16_t *accumulated, const uint16_t *ambient, int tiles_count);
+	void (*resolve_lighting)(unsigned char *lighting, const uint16_t *accumulated, int fraction_bits, int tiles_count);
+	void (*transpose)(unsigned char *pixels, const unsigned char *column_pixels, int width, int height);
+};
+
+void rc_kernels_init(void);
+enum rc_kernels_isa rc_kernels_get_isa(void);
+const char *rc_kernels_get_isa_name(enum rc_kernels_isa isa);
+const struct rc_kernels *rc_kernels_get(void);
+const struct rc_kernels_spans *rc_kernels_get_spans(int tex_width, int tex_height);
+
+#endif
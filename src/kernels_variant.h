@@ -0,0 +1,201 @@
+// Included by kernels.c once for each instruction set, with the target already set and
+// RC_KERNELS_VARIANT(name) defined to give each copy of a kernel a unique name
+// Kernels are plain loops so the compiler can vectorize them with whatever the target allows
+
+// Exactly color * light / 255 for 8-bit color and light
+static inline unsigned char RC_KERNELS_VARIANT(rc_kernels_internal_light)(unsigned color, unsigned light) {
+	const unsigned product = color * light;
+	return (product + 1 + (product >> 8)) >> 8;
+}
+
+// Contiguous spans get their own loop so it can be vectorized
+static void RC_KERNELS_VARIANT(rc_kernels_internal_light_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict colors, const unsigned char *restrict lights, int count) {
+	if (pixels_stride == 1) {
+		for (int i = 0; i < 4 * count; i++)
+			pixels[i] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(colors[i], lights[i]);
+		return;
+	}
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < 4; j++)
+			pixels[4 * i * pixels_stride + j] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(colors[4 * i + j], lights[4 * i + j]);
+}
+
+// Palettes are lit once so quantized textures can be drawn from them without lighting each pixel
+static void RC_KERNELS_VARIANT(rc_kernels_internal_light_palette)(unsigned char *restrict lit_palette, const unsigned char *restrict palette, const unsigned char *restrict light, int colors_count) {
+	for (int i = 0; i < colors_count; i++)
+		for (int j = 0; j < 4; j++)
+			lit_palette[4 * i + j] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(palette[4 * i + j], light[j]);
+}
+
+// Span kernels are inlined into copies for each of RC_KERNELS_SPAN_SIZES, so keep them small
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_wall_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict texels, int texels_stride, double tex_y, double texels_per_row, const unsigned char *restrict light, int count) {
+	for (int i = 0; i < count; i++) {
+		const unsigned char *texel = &texels[4 * (int) tex_y * texels_stride];
+		unsigned char *pixel = &pixels[4 * i * pixels_stride];
+		for (int j = 0; j < 4; j++)
+			pixel[j] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(texel[j], light[j]);
+		tex_y -= texels_per_row;
+	}
+}
+
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_wall_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict indices, int indices_stride, double tex_y, double texels_per_row, const unsigned char *restrict lit_palette, int count) {
+	for (int i = 0; i < count; i++) {
+		memcpy(&pixels[4 * i * pixels_stride], &lit_palette[4 * indices[(int) tex_y * indices_stride]], 4);
+		tex_y -= texels_per_row;
+	}
+}
+
+// Sprite texture rows run upwards on-screen, so rows after the end of the span are skipped and drawing stops at the first row before it
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_sprite_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict texels, int texels_stride, int tex_height, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *restrict light, int count) {
+	for (int i = 0; i < count; i++) {
+		const int tex_y = tex_height - (tex_row + i) * texels_per_row - 1;
+		if (tex_y >= span_end)
+			continue;
+		if (tex_y < span_first)
+			break;
+		const unsigned char *texel = &texels[4 * tex_y * texels_stride];
+		unsigned char *pixel = &pixels[4 * i * pixels_stride];
+		for (int j = 0; j < 4; j++)
+			pixel[j] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(texel[j], light[j]);
+	}
+}
+
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_sprite_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict indices, int indices_stride, int tex_height, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *restrict lit_palette, int count) {
+	for (int i = 0; i < count; i++) {
+		const int tex_y = tex_height - (tex_row + i) * texels_per_row - 1;
+		if (tex_y >= span_end)
+			continue;
+		if (tex_y < span_first)
+			break;
+		memcpy(&pixels[4 * i * pixels_stride], &lit_palette[4 * indices[tex_y * indices_stride]], 4);
+	}
+}
+
+// Square power-of-two textures step through rows in fixed point, and rows wrap with a mask rather than a multiply
+// Coordinates are divided rather than shifted so they truncate towards zero like the generic kernels do
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_wall_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict texels, int size, double tex_y, double texels_per_row, const unsigned char *restrict light, int count) {
+	int32_t fixed_tex_y = tex_y * RC_KERNELS_FIXED_POINT_ONE;
+	const int32_t fixed_texels_per_row = texels_per_row * RC_KERNELS_FIXED_POINT_ONE + 0.5;
+	for (int i = 0; i < count; i++) {
+		const unsigned char *texel = &texels[4 * size * ((fixed_tex_y / RC_KERNELS_FIXED_POINT_ONE) & (size - 1))];
+		unsigned char *pixel = &pixels[4 * i * pixels_stride];
+		for (int j = 0; j < 4; j++)
+			pixel[j] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(texel[j], light[j]);
+		fixed_tex_y -= fixed_texels_per_row;
+	}
+}
+
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_palettized_wall_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict indices, int size, double tex_y, double texels_per_row, const unsigned char *restrict lit_palette, int count) {
+	int32_t fixed_tex_y = tex_y * RC_KERNELS_FIXED_POINT_ONE;
+	const int32_t fixed_texels_per_row = texels_per_row * RC_KERNELS_FIXED_POINT_ONE + 0.5;
+	for (int i = 0; i < count; i++) {
+		memcpy(&pixels[4 * i * pixels_stride], &lit_palette[4 * indices[size * ((fixed_tex_y / RC_KERNELS_FIXED_POINT_ONE) & (size - 1))]], 4);
+		fixed_tex_y -= fixed_texels_per_row;
+	}
+}
+
+// Sprite rows are already checked against the span, so they need no mask
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_sprite_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict texels, int size, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *restrict light, int count) {
+	int32_t fixed_tex_y = (size - 1 - tex_row * texels_per_row) * RC_KERNELS_FIXED_POINT_ONE;
+	const int32_t fixed_texels_per_row = texels_per_row * RC_KERNELS_FIXED_POINT_ONE + 0.5;
+	for (int i = 0; i < count; i++, fixed_tex_y -= fixed_texels_per_row) {
+		const int tex_y = fixed_tex_y / RC_KERNELS_FIXED_POINT_ONE;
+		if (tex_y >= span_end)
+			continue;
+		if (tex_y < span_first)
+			break;
+		const unsigned char *texel = &texels[4 * size * tex_y];
+		unsigned char *pixel = &pixels[4 * i * pixels_stride];
+		for (int j = 0; j < 4; j++)
+			pixel[j] = RC_KERNELS_VARIANT(rc_kernels_internal_light)(texel[j], light[j]);
+	}
+}
+
+static inline void RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_palettized_sprite_span)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict indices, int size, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *restrict lit_palette, int count) {
+	int32_t fixed_tex_y = (size - 1 - tex_row * texels_per_row) * RC_KERNELS_FIXED_POINT_ONE;
+	const int32_t fixed_texels_per_row = texels_per_row * RC_KERNELS_FIXED_POINT_ONE + 0.5;
+	for (int i = 0; i < count; i++, fixed_tex_y -= fixed_texels_per_row) {
+		const int tex_y = fixed_tex_y / RC_KERNELS_FIXED_POINT_ONE;
+		if (tex_y >= span_end)
+			continue;
+		if (tex_y < span_first)
+			break;
+		memcpy(&pixels[4 * i * pixels_stride], &lit_palette[4 * indices[size * tex_y]], 4);
+	}
+}
+
+// Copies of the sized span kernels with the size of one texture as a constant
+// These must match RC_KERNELS_SPAN_SIZES in kernels.c
+#define RC_KERNELS_SIZED_SPANS(size) \
+static void RC_KERNELS_VARIANT(rc_kernels_internal_draw_wall_span_##size)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict texels, int texels_stride, double tex_y, double texels_per_row, const unsigned char *restrict light, int count) { \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_wall_span)(pixels, pixels_stride, texels, size, tex_y, texels_per_row, light, count); \
+} \
+static void RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_wall_span_##size)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict indices, int indices_stride, double tex_y, double texels_per_row, const unsigned char *restrict lit_palette, int count) { \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_palettized_wall_span)(pixels, pixels_stride, indices, size, tex_y, texels_per_row, lit_palette, count); \
+} \
+static void RC_KERNELS_VARIANT(rc_kernels_internal_draw_sprite_span_##size)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict texels, int texels_stride, int tex_height, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *restrict light, int count) { \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_sprite_span)(pixels, pixels_stride, texels, size, tex_row, texels_per_row, span_first, span_end, light, count); \
+} \
+static void RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_sprite_span_##size)(unsigned char *restrict pixels, int pixels_stride, const unsigned char *restrict indices, int indices_stride, int tex_height, int tex_row, double texels_per_row, int span_first, int span_end, const unsigned char *restrict lit_palette, int count) { \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_sized_palettized_sprite_span)(pixels, pixels_stride, indices, size, tex_row, texels_per_row, span_first, span_end, lit_palette, count); \
+}
+#define RC_KERNELS_SIZED_SPANS_ENTRY(size) { \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_wall_span_##size), \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_wall_span_##size), \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_sprite_span_##size), \
+	RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_sprite_span_##size) \
+}
+RC_KERNELS_SIZED_SPANS(32)
+RC_KERNELS_SIZED_SPANS(64)
+RC_KERNELS_SIZED_SPANS(128)
+RC_KERNELS_SIZED_SPANS(256)
+
+static void RC_KERNELS_VARIANT(rc_kernels_internal_fill_lighting)(uint16_t *restrict accumulated, const uint16_t *restrict ambient, int tiles_count) {
+	for (int i = 0; i < tiles_count; i++)
+		for (int j = 0; j < 4; j++)
+			accumulated[4 * i + j] = ambient[j];
+}
+
+// Accumulated lighting has fraction_bits bits below the 8-bit light, and saturates when overbright
+static void RC_KERNELS_VARIANT(rc_kernels_internal_resolve_lighting)(unsigned char *restrict lighting, const uint16_t *restrict accumulated, int fraction_bits, int tiles_count) {
+	for (int i = 0; i < 4 * tiles_count; i++) {
+		const unsigned resolved = accumulated[i] >> fraction_bits;
+		lighting[i] = (resolved > 0xff) ? 0xff : resolved;
+	}
+}
+
+// Copy a column-major frame into a row-major one a block at a time, so both sides stay in cache
+static void RC_KERNELS_VARIANT(rc_kernels_internal_transpose)(unsigned char *restrict pixels, const unsigned char *restrict column_pixels, int width, int height) {
+	for (int block_row = 0; block_row < height; block_row += RC_KERNELS_TRANSPOSE_BLOCK_SIZE) {
+		const int end_row = (block_row + RC_KERNELS_TRANSPOSE_BLOCK_SIZE < height) ? block_row + RC_KERNELS_TRANSPOSE_BLOCK_SIZE : height;
+		for (int block_column = 0; block_column < width; block_column += RC_KERNELS_TRANSPOSE_BLOCK_SIZE) {
+			const int end_column = (block_column + RC_KERNELS_TRANSPOSE_BLOCK_SIZE < width) ? block_column + RC_KERNELS_TRANSPOSE_BLOCK_SIZE : width;
+			for (int row = block_row; row < end_row; row++)
+				for (int column = block_column; column < end_column; column++)
+					memcpy(&pixels[4 * (row * width + column)], &column_pixels[4 * (column * height + row)], 4);
+		}
+	}
+}
+
+static const struct rc_kernels RC_KERNELS_VARIANT(rc_kernels_internal_kernels) = {
+	RC_KERNELS_VARIANT(rc_kernels_internal_light_span),
+	RC_KERNELS_VARIANT(rc_kernels_internal_light_palette),
+	{
+		RC_KERNELS_VARIANT(rc_kernels_internal_draw_wall_span),
+		RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_wall_span),
+		RC_KERNELS_VARIANT(rc_kernels_internal_draw_sprite_span),
+		RC_KERNELS_VARIANT(rc_kernels_internal_draw_palettized_sprite_span)
+	},
+	{
+		RC_KERNELS_SIZED_SPANS_ENTRY(32),
+		RC_KERNELS_SIZED_SPANS_ENTRY(64),
+		RC_KERNELS_SIZED_SPANS_ENTRY(128),
+		RC_KERNELS_SIZED_SPANS_ENTRY(256)
+	},
+	RC_KERNELS_VARIANT(rc_kernels_internal_fill_lighting),
+	RC_KERNELS_VARIANT(rc_kernels_internal_resolve_lighting),
+	RC_KERNELS_VARIANT(rc_kernels_internal_transpose)
+};
+
+#undef RC_KERNELS_SIZED_SPANS
+#undef RC_KERNELS_SIZED_SPANS_ENTRY
@@ -1,17 +1,117 @@
 #include "logging.h"
 #include "timer.h"
+#include "platform.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#ifdef RC_LINUX
+#include <pthread.h>
+#include <time.h>
+#elif defined RC_WINDOWS
+#include <windows.h>
+#endif
+
+// Logging only packs the message format and its arguments into a fixed size record in a ring buffer, the records are
+// formatted and printed by a background thread
+// Producers never wait for space - if the ring is full the message is dropped and counted instead
+// Producers never wake the flush thread, it polls the ring and backs off while it stays empty - so logging is only
+// atomics, and a burst is printed within RC_LOG_FLUSH_INTERVAL_MAX
+// Messages are also rate limited per format, so a warning hit every frame can't flood the log
+
+#define RC_LOG_RING_CAPACITY 1024
+#define RC_LOG_ARGS_SIZE 200
+#define RC_LOG_RATE_LIMIT 20
+#define RC_LOG_RATE_LIMIT_FORMATS 64
+#define RC_LOG_FLUSH_INTERVAL_MIN 1000000 // nanoseconds
+#define RC_LOG_FLUSH_INTERVAL_MAX 20000000
+
+struct rc_log_record {
+	atomic_size_t sequence;
+	double time;
+	const char *format;
+	enum rc_log_urgency urgency;
+	unsigned suppressed_count;
+	bool is_truncated;
+	unsigned short args_size;
+	unsigned char args[RC_LOG_ARGS_SIZE];
+};
+
+// Messages with the same format are limited to RC_LOG_RATE_LIMIT each second
+// Each slot is claimed by the first format logged into it, and other formats sharing the slot are never limited
+// The current second and the count within it share one word (second in the upper half), so a new second is started
+// and counted in a single compare and swap
+struct rc_log_rate_limit {
+	_Atomic(const char *) format;
+	_Atomic uint64_t window;
+	atomic_uint suppressed_count;
+};
 
 static bool is_initiated = false;
 static struct rc_timer *init_timer;
+static FILE *output_file;
+static enum rc_log_urgency output_minimum_urgency = RC_LOG_VERBOSE;
 static const char *RC_LOG_FORMAT = "%.4f [%s] %s\n";
 static const char *RC_LOG_URGENCY_LABELS[rc_log_urgency_count] = { "DBUG", "INFO", "NOTE", "WARN", "ERRR" };
 
+static struct rc_log_record ring[RC_LOG_RING_CAPACITY];
+static atomic_size_t enqueue_position, dequeue_position;
+static atomic_uint dropped_count;
+static struct rc_log_rate_limit rate_limits[RC_LOG_RATE_LIMIT_FORMATS];
+#ifdef RC_LINUX
+static pthread_t flush_thread;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_wakeup = PTHREAD_COND_INITIALIZER;
+#elif defined RC_WINDOWS
+static HANDLE flush_thread;
+static SRWLOCK flush_mutex = SRWLOCK_INIT;
+static CONDITION_VARIABLE flush_wakeup = CONDITION_VARIABLE_INIT;
+#endif
+static bool is_flush_thread_stopping;
+
+static struct rc_log_rate_limit *rc_log_internal_get_rate_limit(enum rc_log_urgency urgency, const char *format);
+static bool rc_log_internal_is_rate_limited(struct rc_log_rate_limit *rate_limit, unsigned second);
+static bool rc_log_internal_pack(struct rc_log_record *record, const char *format, va_list args);
+static bool rc_log_internal_is_pending(void);
+static bool rc_log_internal_print_next(void);
+static void rc_log_internal_format(const struct rc_log_record *record, char *message, size_t message_size);
+static void rc_log_internal_idle(void);
+static void rc_log_internal_wake_flush_thread(bool is_stopping);
+static bool rc_log_internal_wait_flush_thread(long interval);
+#ifdef RC_LINUX
+static void *rc_log_internal_start_flush_thread(void *unused);
+#elif defined RC_WINDOWS
+static DWORD WINAPI rc_log_internal_start_flush_thread(LPVOID unused);
+#endif
+static void rc_log_internal_flush_thread(void);
+
+// Print messages of at least the given urgency to a file other than stdout - must be called before initializing
+void rc_log_set_output(FILE *file, enum rc_log_urgency minimum_urgency) {
+	output_file = file;
+	output_minimum_urgency = minimum_urgency;
+}
+
 void rc_log_init(void) {
+	if (!output_file)
+		output_file = stdout;
 	init_timer = rc_timer_create();
+	for (size_t i = 0; i < RC_LOG_RING_CAPACITY; i++)
+		atomic_init(&ring[i].sequence, i);
+#ifdef RC_LINUX
+	const bool is_started = !pthread_create(&flush_thread, NULL, rc_log_internal_start_flush_thread, NULL);
+#elif defined RC_WINDOWS
+	flush_thread = CreateThread(NULL, 0, rc_log_internal_start_flush_thread, NULL, 0, NULL);
+	const bool is_started = flush_thread != NULL;
+#endif
+	if (!is_started) {
+		fputs("Unable to start logging thread, aborting...", stderr);
+		exit(1);
+	}
 	is_initiated = true;
 	rc_log(RC_LOG_NOTEWORTHY, "Logging system initialized.");
 }
@@ -30,34 +130,385 @@ void rc_log_variadic(enum rc_log_urgency urgency, const char *message, va_list a
 		return;
 #endif
 
-	if (!is_initiated)
+	if (!is_initiated || urgency < output_minimum_urgency)
 		return;
 
-	// Determine size of formatted message
-	va_list args_copy;
-	va_copy(args_copy, args);
-	int formatted_message_length = vsnprintf(NULL, 0, message, args_copy) + 1;
-	va_end(args_copy);
+	// Drop messages over the rate limit, the next message let through reports how many were dropped
+	const double time = rc_timer_measure(init_timer);
+	struct rc_log_rate_limit *rate_limit = rc_log_internal_get_rate_limit(urgency, message);
+	if (rate_limit && rc_log_internal_is_rate_limited(rate_limit, time)) {
+		atomic_fetch_add(&rate_limit->suppressed_count, 1);
+		return;
+	}
 
-	// Allocate space and format message
-	char *formatted_message = malloc(sizeof *formatted_message * formatted_message_length);
-	if (!formatted_message) {
-		fputs("Unable to write log, aborting...", stderr);
-		exit(1);
+	// Claim the next free record in the ring
+	struct rc_log_record *record;
+	size_t position = atomic_load_explicit(&enqueue_position, memory_order_relaxed);
+	while (true) {
+		record = &ring[position % RC_LOG_RING_CAPACITY];
+		const size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+		if (sequence == position) {
+			if (atomic_compare_exchange_weak_explicit(&enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (sequence < position) {
+			atomic_fetch_add(&dropped_count, 1);
+			return;
+		} else {
+			position = atomic_load_explicit(&enqueue_position, memory_order_relaxed);
+		}
 	}
-	vsprintf(formatted_message, message, args);
 
-	// Print log in RC_LOG_FORMAT format
-	double time_since_init = rc_timer_measure(init_timer);
-	const char *urgency_label = RC_LOG_URGENCY_LABELS[urgency];
-	printf(RC_LOG_FORMAT, time_since_init, urgency_label, formatted_message);
-	free(formatted_message);
+	// Fill in the record and publish it to the flush thread
+	record->time = time;
+	record->format = message;
+	record->urgency = urgency;
+	record->suppressed_count = (rate_limit) ? atomic_exchange(&rate_limit->suppressed_count, 0) : 0;
+	record->is_truncated = !rc_log_internal_pack(record, message, args);
+	atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+}
+
+// Wait until every message logged so far has been printed
+void rc_log_flush(void) {
+	if (!is_initiated)
+		return;
+	const size_t position = atomic_load(&enqueue_position);
+	if (atomic_load(&dequeue_position) < position)
+		rc_log_internal_wake_flush_thread(false);
+	while (atomic_load(&dequeue_position) < position)
+		rc_log_internal_idle();
 }
 
 void rc_log_cleanup(void) {
 	if (is_initiated) {
 		rc_log(RC_LOG_INFO, "Cleaning up logging system...");
+		rc_log_internal_wake_flush_thread(true);
+#ifdef RC_LINUX
+		pthread_join(flush_thread, NULL);
+#elif defined RC_WINDOWS
+		WaitForSingleObject(flush_thread, INFINITE);
+		CloseHandle(flush_thread);
+#endif
 		rc_timer_destroy(init_timer);
 		is_initiated = false;
 	}
 }
+
+// Errors are never rate limited, and neither are formats whose slot was claimed by another format
+static struct rc_log_rate_limit *rc_log_internal_get_rate_limit(enum rc_log_urgency urgency, const char *format) {
+	if (urgency == RC_LOG_ERROR)
+		return NULL;
+	struct rc_log_rate_limit *rate_limit = &rate_limits[(uintptr_t) format / sizeof (void *) % RC_LOG_RATE_LIMIT_FORMATS];
+	const char *claimed_format = NULL;
+	if (atomic_compare_exchange_strong(&rate_limit->format, &claimed_format, format) || claimed_format == format)
+		return rate_limit;
+	return NULL;
+}
+
+// Count a message against its format's limit for the second, returns true if it is over the limit
+// Threads logging a second which has already passed count against the current one instead of starting it again
+static bool rc_log_internal_is_rate_limited(struct rc_log_rate_limit *rate_limit, unsigned second) {
+	uint64_t window = atomic_load_explicit(&rate_limit->window, memory_order_relaxed), next_window;
+	do {
+		const unsigned window_second = window >> 32, window_count = (uint32_t) window;
+		if (window_second >= second && window_count >= RC_LOG_RATE_LIMIT)
+			return true;
+		next_window = (window_second >= second) ? window + 1 : (uint64_t) second << 32 | 1;
+	} while (!atomic_compare_exchange_weak_explicit(&rate_limit->window, &window, next_window, memory_order_relaxed, memory_order_relaxed));
+	return false;
+}
+
+// Copy the arguments of the format into the record so they can be formatted later
+// Strings are copied too, as they may not live until the record is printed
+// Returns false if the arguments didn't all fit
+static bool rc_log_internal_pack(struct rc_log_record *record, const char *format, va_list args) {
+	va_list args_copy;
+	va_copy(args_copy, args);
+	size_t size = 0;
+	bool is_complete = true;
+	for (const char *c = format; *c && is_complete; c++) {
+		if (*c != '%')
+			continue;
+
+		// Skip to the conversion, packing any '*' widths or precisions on the way
+		c++;
+		int length = 0;
+		for (; *c && strchr("-+ #0123456789.*hlLqjzt", *c); c++) {
+			if (*c == '*') {
+				const int value = va_arg(args_copy, int);
+				if ((is_complete = size + sizeof value <= RC_LOG_ARGS_SIZE))
+					memcpy(&record->args[size], &value, sizeof value), size += sizeof value;
+			} else if (strchr("hlLqjzt", *c)) {
+				length = (*c == 'l' && length == 'l') ? 'q' : (*c == 'h' && length == 'h') ? 'H' : *c;
+			}
+		}
+
+		// Integers are widened so they can all be formatted the same way
+		switch (*c) {
+			case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c': {
+				const bool is_signed = *c == 'd' || *c == 'i' || *c == 'c';
+				long long value;
+				switch (length) {
+					case 'l': value = is_signed ? va_arg(args_copy, long) : (long long) va_arg(args_copy, unsigned long); break;
+					case 'q': case 'L': value = va_arg(args_copy, long long); break;
+					case 'z': value = va_arg(args_copy, size_t); break;
+					case 'j': value = va_arg(args_copy, intmax_t); break;
+					case 't': value = va_arg(args_copy, ptrdiff_t); break;
+					default: value = is_signed ? va_arg(args_copy, int) : (long long) va_arg(args_copy, unsigned); break;
+				}
+				if ((is_complete = size + sizeof value <= RC_LOG_ARGS_SIZE))
+					memcpy(&record->args[size], &value, sizeof value), size += sizeof value;
+				break;
+			}
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				if (length == 'L') {
+					const long double value = va_arg(args_copy, long double);
+					if ((is_complete = size + sizeof value <= RC_LOG_ARGS_SIZE))
+						memcpy(&record->args[size], &value, sizeof value), size += sizeof value;
+				} else {
+					const double value = va_arg(args_copy, double);
+					if ((is_complete = size + sizeof value <= RC_LOG_ARGS_SIZE))
+						memcpy(&record->args[size], &value, sizeof value), size += sizeof value;
+				}
+				break;
+			}
+			case 'p': {
+				const void *value = va_arg(args_copy, void *);
+				if ((is_complete = size + sizeof value <= RC_LOG_ARGS_SIZE))
+					memcpy(&record->args[size], &value, sizeof value), size += sizeof value;
+				break;
+			}
+			case 's': {
+				const char *value = va_arg(args_copy, const char *);
+				const size_t value_length = strlen(value ? value : "(null)");
+				const size_t copied_length = (size + value_length < RC_LOG_ARGS_SIZE) ? value_length : RC_LOG_ARGS_SIZE - size - 1;
+				if ((is_complete = size < RC_LOG_ARGS_SIZE)) {
+					memcpy(&record->args[size], value ? value : "(null)", copied_length);
+					record->args[size + copied_length] = '\0';
+					size += copied_length + 1;
+					is_complete = copied_length == value_length;
+				}
+				break;
+			}
+			case '\0':
+				c--;
+				break;
+		}
+	}
+	va_end(args_copy);
+	record->args_size = size;
+	return is_complete;
+}
+
+// Whether the next record has been published
+static bool rc_log_internal_is_pending(void) {
+	const size_t position = atomic_load_explicit(&dequeue_position, memory_order_relaxed);
+	return atomic_load_explicit(&ring[position % RC_LOG_RING_CAPACITY].sequence, memory_order_acquire) == position + 1;
+}
+
+// Print the next record if it has been published, returns false if there was nothing to print
+static bool rc_log_internal_print_next(void) {
+	if (!rc_log_internal_is_pending())
+		return false;
+	const size_t position = atomic_load_explicit(&dequeue_position, memory_order_relaxed);
+	struct rc_log_record *record = &ring[position % RC_LOG_RING_CAPACITY];
+
+	char message[1024];
+	rc_log_internal_format(record, message, sizeof message);
+	fprintf(output_file, RC_LOG_FORMAT, record->time, RC_LOG_URGENCY_LABELS[record->urgency], message);
+	if (record->suppressed_count)
+		fprintf(output_file, "%.4f [%s] %u earlier messages like this were rate limited\n", record->time, RC_LOG_URGENCY_LABELS[record->urgency], record->suppressed_count);
+	const unsigned dropped = atomic_exchange(&dropped_count, 0);
+	if (dropped)
+		fprintf(output_file, "%.4f [%s] %u messages were dropped as the log was full\n", record->time, RC_LOG_URGENCY_LABELS[RC_LOG_WARN], dropped);
+
+	// Hand the record back to the producers
+	atomic_store_explicit(&record->sequence, position + RC_LOG_RING_CAPACITY, memory_order_release);
+	atomic_store(&dequeue_position, position + 1);
+	return true;
+}
+
+// Walk the format again, formatting each conversion with its packed argument
+static void rc_log_internal_format(const struct rc_log_record *record, char *message, size_t message_size) {
+	size_t length = 0, args_offset = 0;
+	for (const char *c = record->format; *c && length + 1 < message_size; c++) {
+		if (*c != '%') {
+			message[length++] = *c;
+			continue;
+		}
+
+		// Rebuild the conversion specification with any '*' replaced by its value and the length modifier replaced
+		// by the one for how the argument was packed
+		char specification[64] = "%";
+		size_t specification_length = 1;
+		bool is_long_double = false;
+		for (c++; *c && strchr("-+ #0123456789.*hlLqjzt", *c) && specification_length < 32; c++) {
+			if (*c == '*') {
+				int value;
+				if (args_offset + sizeof value > record->args_size)
+					goto truncated;
+				memcpy(&value, &record->args[args_offset], sizeof value);
+				args_offset += sizeof value;
+				specification_length += snprintf(&specification[specification_length], sizeof specification - specification_length, "%i", value);
+			} else if (strchr("hlqjzt", *c)) {
+				continue;
+			} else if (*c == 'L') {
+				is_long_double = true;
+			} else {
+				specification[specification_length++] = *c;
+			}
+		}
+		if (!*c)
+			break;
+
+		const size_t remaining = message_size - length;
+		int written = 0;
+		switch (*c) {
+			case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c': {
+				long long value;
+				if (args_offset + sizeof value > record->args_size)
+					goto truncated;
+				memcpy(&value, &record->args[args_offset], sizeof value);
+				args_offset += sizeof value;
+				if (*c == 'c') {
+					specification[specification_length++] = 'c';
+					specification[specification_length] = '\0';
+					written = snprintf(&message[length], remaining, specification, (int) value);
+				} else {
+					specification[specification_length++] = 'l';
+					specification[specification_length++] = 'l';
+					specification[specification_length++] = *c;
+					specification[specification_length] = '\0';
+					written = snprintf(&message[length], remaining, specification, value);
+				}
+				break;
+			}
+			case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+				if (is_long_double)
+					specification[specification_length++] = 'L';
+				specification[specification_length++] = *c;
+				specification[specification_length] = '\0';
+				if (is_long_double) {
+					long double value;
+					if (args_offset + sizeof value > record->args_size)
+						goto truncated;
+					memcpy(&value, &record->args[args_offset], sizeof value);
+					args_offset += sizeof value;
+					written = snprintf(&message[length], remaining, specification, value);
+				} else {
+					double value;
+					if (args_offset + sizeof value > record->args_size)
+						goto truncated;
+					memcpy(&value, &record->args[args_offset], sizeof value);
+					args_offset += sizeof value;
+					written = snprintf(&message[length], remaining, specification, value);
+				}
+				break;
+			}
+			case 'p': {
+				void *value;
+				if (args_offset + sizeof value > record->args_size)
+					goto truncated;
+				memcpy(&value, &record->args[args_offset], sizeof value);
+				args_offset += sizeof value;
+				specification[specification_length++] = 'p';
+				specification[specification_length] = '\0';
+				written = snprintf(&message[length], remaining, specification, value);
+				break;
+			}
+			case 's': {
+				if (args_offset >= record->args_size)
+					goto truncated;
+				const char *value = (const char *) &record->args[args_offset];
+				args_offset += strlen(value) + 1;
+				specification[specification_length++] = 's';
+				specification[specification_length] = '\0';
+				written = snprintf(&message[length], remaining, specification, value);
+				break;
+			}
+			case '%':
+				message[length++] = '%';
+				break;
+		}
+		length += (written > 0) ? ((size_t) written < remaining ? (size_t) written : remaining - 1) : 0;
+	}
+	message[length] = '\0';
+	if (!record->is_truncated)
+		return;
+
+truncated:
+	snprintf(&message[length], message_size - length, "...");
+}
+
+static void rc_log_internal_idle(void) {
+#ifdef RC_LINUX
+	const struct timespec duration = { 0, 100000 };
+	nanosleep(&duration, NULL);
+#elif defined RC_WINDOWS
+	Sleep(0);
+#endif
+}
+
+// Cut the flush threads wait short, for callers which need the ring emptied now rather than at its next poll
+static void rc_log_internal_wake_flush_thread(bool is_stopping) {
+#ifdef RC_LINUX
+	pthread_mutex_lock(&flush_mutex);
+	is_flush_thread_stopping |= is_stopping;
+	pthread_cond_signal(&flush_wakeup);
+	pthread_mutex_unlock(&flush_mutex);
+#elif defined RC_WINDOWS
+	AcquireSRWLockExclusive(&flush_mutex);
+	is_flush_thread_stopping |= is_stopping;
+	WakeConditionVariable(&flush_wakeup);
+	ReleaseSRWLockExclusive(&flush_mutex);
+#endif
+}
+
+// Sleep the flush thread for the interval in nanoseconds or until woken, returns true if it should stop
+static bool rc_log_internal_wait_flush_thread(long interval) {
+#ifdef RC_LINUX
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += interval;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000;
+	deadline.tv_nsec %= 1000000000;
+	pthread_mutex_lock(&flush_mutex);
+	const bool is_stopping = is_flush_thread_stopping;
+	if (!is_stopping)
+		pthread_cond_timedwait(&flush_wakeup, &flush_mutex, &deadline);
+	pthread_mutex_unlock(&flush_mutex);
+#elif defined RC_WINDOWS
+	AcquireSRWLockExclusive(&flush_mutex);
+	const bool is_stopping = is_flush_thread_stopping;
+	if (!is_stopping)
+		SleepConditionVariableSRW(&flush_wakeup, &flush_mutex, interval / 1000000, 0);
+	ReleaseSRWLockExclusive(&flush_mutex);
+#endif
+	return is_stopping;
+}
+
+#ifdef RC_LINUX
+static void *rc_log_internal_start_flush_thread(void *unused) {
+	rc_log_internal_flush_thread();
+	return NULL;
+}
+#elif defined RC_WINDOWS
+static DWORD WINAPI rc_log_internal_start_flush_thread(LPVOID unused) {
+	rc_log_internal_flush_thread();
+	return 0;
+}
+#endif
+
+// Print records as they arrive, polling the ring less often the longer it stays empty, then print whatever is left once stopped
+static void rc_log_internal_flush_thread(void) {
+	long interval = RC_LOG_FLUSH_INTERVAL_MIN;
+	while (true) {
+		while (rc_log_internal_print_next())
+			interval = RC_LOG_FLUSH_INTERVAL_MIN;
+		fflush(output_file);
+		if (rc_log_internal_wait_flush_thread(interval))
+			break;
+		interval = (interval * 2 < RC_LOG_FLUSH_INTERVAL_MAX) ? interval * 2 : RC_LOG_FLUSH_INTERVAL_MAX;
+	}
+	while (rc_log_internal_print_next());
+	fflush(output_file);
+}
@@ -2,6 +2,7 @@
 #define RC_LOGGING_H
 
 #include <stdarg.h>
+#include <stdio.h>
 
 enum rc_log_urgency {
 	RC_LOG_VERBOSE = 0,
@@ -12,9 +13,11 @@ enum rc_log_urgency {
 	rc_log_urgency_count
 };
 
+void rc_log_set_output(FILE *file, enum rc_log_urgency minimum_urgency);
 void rc_log_init(void);
 void rc_log(enum rc_log_urgency urgency, const char *message, ...);
 void rc_log_variadic(enum rc_log_urgency urgency, const char *message, va_list args);
+void rc_log_flush(void);
 void rc_log_cleanup(void);
 
 #endif
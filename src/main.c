@@ -1,5 +1,6 @@
 #include "platform.h"
 #include "logging.h"
+#include "error.h"
 #include "window.h"
 #include "renderer.h"
 #include "texture.h"
@@ -9,26 +10,69 @@
 #include "map.h"
 #include "light.h"
 #include "timer.h"
+#include "jobs.h"
+#include "assets.h"
+#include "profile.h"
+#include "stats.h"
+#include "kernels.h"
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
+
+static int barrel_behavior, projectile_behavior;
+
+// Barrels are solid
+void rc_barrel_init(struct rc_entity_pool *pool, struct rc_entity_handle barrel) {
+	rc_entity_set_radius(pool, barrel, 0.25);
+}
 
 // Funky wandering barrel update function
 #include <math.h>
-void rc_barrel_update(struct rc_entity *barrel, struct rc_map *map) {
+void rc_barrel_update(struct rc_entity_pool *pool, struct rc_entity_handle barrel, const struct rc_map *map) {
 	double x, y, z, r;
-	rc_entity_get_transform(barrel, &x, &y, &z, &r);
+	rc_entity_get_transform(pool, barrel, &x, &y, &z, &r);
 
-	// Walk forward, turn right if there's a wall 0.5 units in-front
-	if (rc_map_get_wall(map, x + cos(r) * 0.5, y + sin(r) * 0.5) != -1)
+	// Walk forward, turn right after bumping into something
+	if (rc_entity_has_collided(pool, barrel))
 		r += DEG2RAD(90);
 	x += cos(r) * 0.025;
 	y += sin(r) * 0.025;
 
-	rc_entity_set_transform(barrel, x, y, z, r);
+	rc_entity_set_transform(pool, barrel, x, y, z, r);
+}
+
+// Projectiles carry a small light with them
+void rc_projectile_init(struct rc_entity_pool *pool, struct rc_entity_handle projectile) {
+	rc_entity_set_light(pool, projectile, rc_light_create(0, 0, 0xff, 0xa0, 0x40, 3, 1.0));
+}
+
+// Projectiles fly straight until they hit a wall, destroying the first barrel they touch
+void rc_projectile_update(struct rc_entity_pool *pool, struct rc_entity_handle projectile, const struct rc_map *map) {
+	double x, y, z, r;
+	rc_entity_get_transform(pool, projectile, &x, &y, &z, &r);
+	x += cos(r) * 0.2;
+	y += sin(r) * 0.2;
+	if (rc_map_get_wall(map, x, y) != -1) {
+		rc_entity_despawn(pool, projectile);
+		return;
+	}
+	rc_entity_set_transform(pool, projectile, x, y, z, r);
+
+	struct rc_entity_handle nearby[8];
+	const int nearby_count = rc_entity_pool_query_radius(pool, x, y, 0.5, nearby, 8);
+	for (int i = 0; i < nearby_count; i++) {
+		if (rc_entity_get_behavior(pool, nearby[i]) == barrel_behavior) {
+			rc_entity_despawn(pool, nearby[i]);
+			rc_entity_despawn(pool, projectile);
+			break;
+		}
+	}
 }
 
 int main(const int argc, const char **argv) {
 	rc_log_init();
+	RC_PROFILE_INIT();
+	rc_kernels_init();
 
 	// Window config
 	const int window_width = 640, window_height = 480;
@@ -37,24 +81,57 @@ int main(const int argc, const char **argv) {
 
 	// Debug variables
 	int tps = 60;                 // ticks per second
+	int max_catch_up_ticks = 5;   // most ticks run before a frame is drawn
+	double stats_interval = 5.0;  // seconds between frame statistics reports
 	int resolution = 200;         // number of vertical pixels
 	double fov = DEG2RAD(60);     // field of view
 	bool is_vsync_enabled = true; // if glfw will wait for vsync
+	int texture_colors = 64;      // palette size of quantized textures
+	bool is_palettized = false;   // if quantized textures are drawn through their palettes
+	int tile_columns = 0;         // columns per tile drawn on the job system, or 0 to draw the whole screen at once
+	bool is_column_major = false; // if frames are drawn column by column rather than row by row
+
+	// Input can be recorded while playing, then replayed without a window as a repeatable benchmark
+	const char *record_filename = NULL, *replay_filename = NULL;
+	for (int i = 1; i < argc; i++) {
+		const bool is_record = !strcmp(argv[i], "--record"), is_replay = !strcmp(argv[i], "--replay");
+		if ((is_record || is_replay) && i + 1 == argc)
+			rc_error("Missing filename after '%s'! Usage: %s [--record filename] [--replay filename]", argv[i], argv[0]);
+		if (is_record)
+			record_filename = argv[++i];
+		else if (is_replay)
+			replay_filename = argv[++i];
+		else
+			rc_log(RC_LOG_WARN, "Unrecognized argument '%s'!", argv[i]);
+	}
+	const bool is_replaying = replay_filename != NULL;
+	if (is_replaying && !rc_input_start_replay(replay_filename))
+		rc_error("Could not replay input from '%s'!", replay_filename);
+	if (record_filename)
+		rc_input_start_recording(record_filename);
 
-	// Load textures
-	rc_log(RC_LOG_INFO, "Loading textures...");
+	// Entity updates and texture decoding are spread across all cores
+	struct rc_job_system *jobs = rc_job_system_create(0);
+
+	// Use pre-decoded textures if they have been packed with 'make pack'
+	rc_texture_mount_pack("out/textures.pack");
+
+	// Start loading textures in the background while the map is set up
+	struct rc_assets *assets = rc_assets_create(jobs);
+	rc_assets_set_texture_colors(assets, texture_colors);
 	const int wall_textures_count = 8;
-	struct rc_texture *wall_textures[8] = {
-		rc_texture_load("res/textures/wood.png"),
-		rc_texture_load("res/textures/greystone.png"),
-		rc_texture_load("res/textures/mossy.png"),
-		rc_texture_load("res/textures/bluestone.png"),
-		rc_texture_load("res/textures/purplestone.png"),
-		rc_texture_load("res/textures/colorstone.png"),
-		rc_texture_load("res/textures/redbrick.png"),
-		rc_texture_load("res/textures/eagle.png")
+	const int wall_texture_assets[8] = {
+		rc_assets_request_texture(assets, "res/textures/wood.png"),
+		rc_assets_request_texture(assets, "res/textures/greystone.png"),
+		rc_assets_request_texture(assets, "res/textures/mossy.png"),
+		rc_assets_request_texture(assets, "res/textures/bluestone.png"),
+		rc_assets_request_texture(assets, "res/textures/purplestone.png"),
+		rc_assets_request_texture(assets, "res/textures/colorstone.png"),
+		rc_assets_request_texture(assets, "res/textures/redbrick.png"),
+		rc_assets_request_texture(assets, "res/textures/eagle.png")
 	};
-	struct rc_texture *light_texture = rc_texture_load("res/textures/barrel.png");
+	const int light_texture_asset = rc_assets_request_texture(assets, "res/textures/barrel.png");
+	rc_assets_load(assets);
 
 	// Debug map
 	rc_log(RC_LOG_INFO, "Initializing game world...");
@@ -95,54 +172,88 @@ int main(const int argc, const char **argv) {
 		0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 6, 6, 6, 0,
 		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 	};
-	// TODO: entities should be able to create and modify their own lights
+	struct rc_map *map = rc_map_create(map_width, map_height, map_floor, map_walls, map_ceiling);
 	const int map_lights_count = 3;
 	struct rc_light *map_lights[3] = {
 		rc_light_create(1,  1, 0xff, 0x00, 0x00, 10, 5.0),
 		rc_light_create(10, 7, 0x00, 0x60, 0xff, 10, 5.0),
 		rc_light_create(17, 7, 0x40, 0x40, 0x40, 10, 5.0)
 	};
-	// TODO: a better entities data structure, optimized for calculating distance from the player
-	// entities should also be modifiable from anywhere? e.g a player should be able to make a projectile
-	const int entities_count = 8;
-	struct rc_entity *entities[8] = {
-		rc_entity_create(2.5,  2.5, 0.5, 0.0, NULL, rc_player_init, rc_player_update, rc_player_destroy),
-		rc_entity_create(10.5, 7.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL),
-		rc_entity_create(2.5,  2.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL),
-		rc_entity_create(18.5, 2.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL),
-		rc_entity_create(7.5,  5.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL),
-		rc_entity_create(18.5, 5.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL),
-		rc_entity_create(2.5,  3.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL),
-		rc_entity_create(12.5, 3.5, 0.5, 0.0, light_texture, NULL, rc_barrel_update, NULL)
-	};
-	struct rc_entity *player = entities[0];
+	rc_map_set_ambient_lighting(map, 0x10, 0x10, 0x10);
+	for (int i = 0; i < map_lights_count; i++)
+		rc_map_add_light(map, map_lights[i]);
 
-	// Create the window, renderer and map
-	struct rc_window *window = rc_window_create("raycaster", window_width, window_height, window_is_resizable, window_is_cursor_disabled, is_vsync_enabled);
-	struct rc_renderer *renderer = rc_renderer_create(window, window_aspect, resolution, fov, wall_textures);
-	struct rc_map *map = rc_map_create(map_width, map_height, map_floor, map_walls, map_ceiling);
+	// Entities need their textures, so wait for them here
+	struct rc_texture *wall_textures[8];
+	for (int i = 0; i < wall_textures_count; i++)
+		wall_textures[i] = rc_assets_get_texture(assets, wall_texture_assets[i]);
+	struct rc_texture *light_texture = rc_assets_get_texture(assets, light_texture_asset);
+
+	struct rc_entity_pool *entities = rc_entity_pool_create(8, map);
+	const int player_behavior = rc_entity_pool_add_behavior(entities, rc_player_init, rc_player_update, rc_player_destroy);
+	barrel_behavior = rc_entity_pool_add_behavior(entities, rc_barrel_init, rc_barrel_update, NULL);
+	projectile_behavior = rc_entity_pool_add_behavior(entities, rc_projectile_init, rc_projectile_update, NULL);
+	const struct rc_entity_handle player = rc_entity_create(entities, 2.5, 2.5, 0.5, 0.0, NULL, player_behavior);
+	rc_entity_create(entities, 10.5, 7.5, 0.5, 0.0, light_texture, barrel_behavior);
+	rc_entity_create(entities, 2.5,  2.5, 0.5, 0.0, light_texture, barrel_behavior);
+	rc_entity_create(entities, 18.5, 2.5, 0.5, 0.0, light_texture, barrel_behavior);
+	rc_entity_create(entities, 7.5,  5.5, 0.5, 0.0, light_texture, barrel_behavior);
+	rc_entity_create(entities, 18.5, 5.5, 0.5, 0.0, light_texture, barrel_behavior);
+	rc_entity_create(entities, 2.5,  3.5, 0.5, 0.0, light_texture, barrel_behavior);
+	rc_entity_create(entities, 12.5, 3.5, 0.5, 0.0, light_texture, barrel_behavior);
+
+	// Create the window and renderer - replays are drawn without a window
+	struct rc_window *window = NULL;
+	struct rc_renderer *renderer;
+	if (is_replaying) {
+		renderer = rc_renderer_create_headless(window_aspect, resolution, fov, wall_textures, wall_textures_count);
+	} else {
+		window = rc_window_create("raycaster", window_width, window_height, window_is_resizable, window_is_cursor_disabled, is_vsync_enabled);
+		renderer = rc_renderer_create(window, window_aspect, resolution, fov, wall_textures, wall_textures_count);
+	}
+	rc_renderer_set_tiles(renderer, tile_columns, jobs);
+	rc_renderer_set_column_major(renderer, is_column_major);
 
 	// Main game loop
 	bool is_running = true;
 	double accumulated_time = 0;
 	struct rc_timer *timer = rc_timer_create();
+	struct rc_timer *tick_timer = rc_timer_create();
+	struct rc_frame_stats *stats = rc_frame_stats_create(stats_interval);
 	rc_log(RC_LOG_NOTEWORTHY, "Entering main game loop...");
 	while (is_running) {
+		RC_PROFILE_BEGIN("frame");
 
 		// Find deltatime
+		// Replays run exactly one tick every frame, as fast as they can
 		const double dt = rc_timer_reset(timer);
-		accumulated_time += dt;
+		accumulated_time += (is_replaying) ? 1.0 / tps : dt;
 
 		// Update 60 times a second
+		int ticks_count = 0, dropped_ticks_count = 0;
 		while (is_running && accumulated_time >= 1.0 / tps) {
+
+			// Drop time that can't be caught up on rather than falling further behind every frame
+			if (ticks_count == max_catch_up_ticks) {
+				dropped_ticks_count = accumulated_time * tps;
+				rc_log(RC_LOG_WARN, "Skipping %i ticks to catch up...", dropped_ticks_count);
+				accumulated_time = fmod(accumulated_time, 1.0 / tps);
+				break;
+			}
+			ticks_count++;
 			accumulated_time -= 1.0 / tps;
+			RC_PROFILE_BEGIN("tick");
+			rc_timer_reset(tick_timer);
 
-			// Update
-			rc_window_update(window);
-			for (int i = 0; i < entities_count; i++)
-				rc_entity_update(entities[i], map);
-			rc_map_generate_lighting(map, 0x10, 0x10, 0x10, map_lights, map_lights_count);
-			if (rc_window_should_close(window))
+			// Update - replays feed recorded input in place of the window
+			if (is_replaying)
+				is_running = rc_input_replay_tick();
+			else
+				rc_window_update(window);
+			rc_input_record_tick();
+			rc_entity_pool_update(entities, map, jobs);
+			rc_map_update_lighting(map);
+			if (window && rc_window_should_close(window))
 				is_running = false;
 
 			// Debug input - TODO: write these as text to the screen
@@ -150,30 +261,56 @@ int main(const int argc, const char **argv) {
 			if (rc_input_is_key_down(RC_INPUT_KEY_PERIOD))    rc_renderer_set_fov(renderer, fov += 0.01);
 			if (rc_input_is_key_pressed(RC_INPUT_KEY_MINUS))  if (resolution > 1) rc_renderer_set_resolution(renderer, --resolution);
 			if (rc_input_is_key_pressed(RC_INPUT_KEY_EQUALS)) rc_renderer_set_resolution(renderer, ++resolution);
-			if (rc_input_is_key_pressed(RC_INPUT_KEY_V))      rc_window_set_vsync_enabled(window, is_vsync_enabled = !is_vsync_enabled);
+			if (rc_input_is_key_pressed(RC_INPUT_KEY_V))      if (window) rc_window_set_vsync_enabled(window, is_vsync_enabled = !is_vsync_enabled);
+			if (rc_input_is_key_pressed(RC_INPUT_KEY_P))      rc_renderer_set_palettized(renderer, is_palettized = !is_palettized);
+			if (rc_input_is_key_pressed(RC_INPUT_KEY_T))      rc_renderer_set_tiles(renderer, tile_columns = (tile_columns) ? 0 : 32, jobs);
+			if (rc_input_is_key_pressed(RC_INPUT_KEY_M))      rc_renderer_set_column_major(renderer, is_column_major = !is_column_major);
 			if (rc_input_is_key_pressed(RC_INPUT_KEY_ESCAPE)) is_running = false;
 
+			// Fire a projectile from the player - it will appear at the end of the next update
+			if (rc_input_is_key_pressed(RC_INPUT_KEY_SPACE)) {
+				double player_x, player_y, player_z, player_r;
+				rc_entity_get_transform(entities, player, &player_x, &player_y, &player_z, &player_r);
+				rc_entity_spawn(entities, player_x, player_y, player_z, player_r, light_texture, projectile_behavior);
+			}
+
 			rc_input_update();
+			rc_frame_stats_record_tick(stats, rc_timer_measure(tick_timer));
+			RC_PROFILE_END();
 		}
+		rc_frame_stats_record_frame(stats, dt, ticks_count, dropped_ticks_count);
 
-		// Render asap
-		rc_window_set_as_context(window);
-		rc_renderer_draw(renderer, map, entities, entities_count, player);
-		rc_window_render(window);
+		// Render asap, interpolating between the last two ticks
+		if (window)
+			rc_window_set_as_context(window);
+		rc_renderer_draw(renderer, map, entities, player, accumulated_time * tps);
+		if (window) {
+			RC_PROFILE_BEGIN("rc_window_render");
+			rc_window_render(window);
+			RC_PROFILE_END();
+		}
+		RC_PROFILE_END();
 	}
 
 	// Cleanup
 	rc_log(RC_LOG_NOTEWORTHY, "Cleaning up...");
+	rc_frame_stats_write_csv(stats, "out/frame_stats.csv");
+	rc_frame_stats_destroy(stats);
+	rc_timer_destroy(tick_timer);
 	rc_timer_destroy(timer);
+	rc_entity_pool_destroy(entities);
 	rc_map_destroy(map);
 	rc_renderer_destroy(renderer);
-	rc_window_destroy(window);
+	if (window)
+		rc_window_destroy(window);
+	rc_input_stop_recording();
+	rc_input_stop_replay();
 	for (int i = 0; i < map_lights_count; i++)
 		rc_light_destroy(map_lights[i]);
-	for (int i = 0; i < entities_count; i++)
-		rc_entity_destroy(entities[i]);
-	for (int i = 0; i < wall_textures_count; i++)
-		rc_texture_unload(wall_textures[i]);
-	rc_texture_unload(light_texture);
+	rc_assets_destroy(assets);
+	rc_texture_unmount_pack();
+	rc_job_system_destroy(jobs);
+	RC_PROFILE_EXPORT("out/profile.json");
+	RC_PROFILE_CLEANUP();
 	rc_log_cleanup();
 }
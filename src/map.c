@@ -2,16 +2,72 @@
 #include "logging.h"
 #include "error.h"
 #include "light.h"
+#include "profile.h"
+#include "counters.h"
+#include "kernels.h"
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Lighting is accumulated with this many bits of sub-8-bit precision, leaving the rest of the 16 bits as HDR headroom
+#define RC_MAP_LIGHTING_FRACTION_BITS 4
 
 struct rc_map {
 	int width, height;
 	int *floor, *walls, *ceiling;
+	int lighting_tiles_count;
+	uint16_t *accumulated_lighting;
 	unsigned char *lighting;
+	enum rc_map_lighting_mode lighting_mode;
+
+	// Lights added to the map are relit incrementally - only tiles within range of a changed light are recalculated
+	uint16_t ambient[4];
+	int lights_count, lights_capacity;
+	struct rc_map_light_record *lights;
+	bool *is_tile_dirty;
+	int dirty_rects_count, dirty_rects_capacity;
+	struct rc_map_rect *dirty_rects;
+	int dirty_min_x, dirty_min_y, dirty_max_x, dirty_max_y;
+
+	// Scratch space for marking the tiles a light has reached, indexed within its range box clipped to the map
+	bool *is_light_tile_visited;
+};
+
+struct rc_map_internal_light {
+	int x, y;
+	uint16_t color[4];
+	int range;
+	double falloff;
+};
+
+// The properties of a light when it was last applied to the lightmap
+struct rc_map_light_record {
+	struct rc_light *light;
+	struct rc_map_internal_light applied;
+	bool is_applied;
 };
 
+struct rc_map_rect {
+	int min_x, min_y, max_x, max_y;
+};
+
+static void rc_map_internal_read_light(const struct rc_light *light, struct rc_map_internal_light *internal_light);
+static bool rc_map_internal_is_same_light(const struct rc_map_internal_light *a, const struct rc_map_internal_light *b);
+static void rc_map_internal_invalidate_light(struct rc_map *map, const struct rc_map_internal_light *light);
+static void rc_map_internal_invalidate_lighting(struct rc_map *map, int min_x, int min_y, int max_x, int max_y);
+static void rc_map_internal_resolve_lighting(const struct rc_map *map, int first_tile, int tiles_count);
+static void rc_map_internal_propagate_light(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask);
+static bool *rc_map_internal_begin_light_visit(const struct rc_map *map, const struct rc_map_internal_light *light, struct rc_map_rect *range_box);
+static void rc_map_internal_apply_light(const struct rc_map *map, int x, int y, const struct rc_map_internal_light *light, double distance, const bool *mask);
+static void rc_map_internal_flood_light(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask);
+static void rc_map_internal_shadowcast_light(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask);
+static void rc_map_internal_shadowcast_octant(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask, bool *is_tile_lit, const struct rc_map_rect *range_box, int row, double start_slope, double end_slope, int xx, int xy, int yx, int yy);
+
 struct rc_map *rc_map_create(int map_width, int map_height, const int *floor, const int *walls, const int *ceiling) {
 	rc_log(RC_LOG_VERBOSE, "Creating new map...");
 	struct rc_map *map = malloc(sizeof *map);
@@ -21,8 +77,14 @@ struct rc_map *rc_map_create(int map_width, int map_height, const int *floor, co
 	map->floor = malloc(sizeof (int) * map_width * map_height);
 	map->walls = malloc(sizeof (int) * map_width * map_height);
 	map->ceiling = malloc(sizeof (int) * map_width * map_height);
-	map->lighting = calloc(3 * map_width * map_height, sizeof (unsigned char));
-	RC_ASSERT(map->floor && map->walls && map->ceiling && map->lighting);
+
+	// Lightmaps are RGBX, padded to a multiple of 4 tiles so the resolve pass never needs a scalar tail
+	map->lighting_tiles_count = (map_width * map_height + 3) & ~3;
+	map->accumulated_lighting = calloc(4 * map->lighting_tiles_count, sizeof (uint16_t));
+	map->lighting = calloc(4 * map->lighting_tiles_count, sizeof (unsigned char));
+	map->is_tile_dirty = calloc(map_width * map_height, sizeof *map->is_tile_dirty);
+	map->is_light_tile_visited = malloc(sizeof *map->is_light_tile_visited * map_width * map_height);
+	RC_ASSERT(map->floor && map->walls && map->ceiling && map->accumulated_lighting && map->lighting && map->is_tile_dirty && map->is_light_tile_visited);
 	for (int i = 0; i < map_width * map_height; i++) {
 		map->floor[i] = floor[i];
 		map->walls[i] = walls[i];
@@ -61,101 +123,165 @@ int rc_map_get_ceiling(const struct rc_map *map, int x, int y) {
 	return map->ceiling[y * map->width + x];
 }
 
+// Step along a ray until it hits a wall, finding the distance to it and how far along its surface the ray hit
+void rc_map_raycast(const struct rc_map *map, double x, double y, double a, int *hit_x, int *hit_y, int *hit_side, double *hit_dst, double *hit_lat) {
+
+	// Starting point
+	*hit_x = x, *hit_y = y;
+	double distance_x = x - *hit_x, distance_y = y - *hit_y;
+
+	// Direction vector
+	const double angle_x = cos(a), angle_y = sin(a);
+	const double delta_x = fabs(1 / angle_x), delta_y = fabs(1 / angle_y);
+
+	// Flip step vector for negative directions
+	int step_x = -1, step_y = -1;
+	if (angle_x >= 0) { distance_x = 1 - distance_x; step_x = 1; }
+	if (angle_y >= 0) { distance_y = 1 - distance_y; step_y = 1; }
+	distance_x *= delta_x; distance_y *= delta_y;
+
+	// Euclidean distance to the nearest wall
+	*hit_side = 0;
+	while (rc_map_get_wall(map, *hit_x, *hit_y) == -1) {
+		if (distance_x < distance_y) {
+			*hit_side = 1;
+			*hit_x += step_x;
+			distance_x += delta_x;
+		} else {
+			*hit_side = 0;
+			*hit_y += step_y;
+			distance_y += delta_y;
+		}
+	}
+
+	// Calculate distance and point on the wall surface
+	*hit_dst = (*hit_side) ? distance_x - delta_x : distance_y - delta_y;
+	*hit_lat = (*hit_side) ? y + angle_y * *hit_dst : x + angle_x * *hit_dst;
+	*hit_lat -= (int)*hit_lat;
+}
+
+void rc_map_set_lighting_mode(struct rc_map *map, enum rc_map_lighting_mode mode) {
+	rc_log(RC_LOG_INFO, (mode == RC_MAP_LIGHTING_SHADOWCAST) ? "Setting map lighting mode to shadowcast..." : "Setting map lighting mode to flood fill...");
+	map->lighting_mode = mode;
+	rc_map_internal_invalidate_lighting(map, 0, 0, map->width - 1, map->height - 1);
+}
+
 void rc_map_generate_lighting(const struct rc_map *map, unsigned char ambient_r, unsigned char ambient_g, unsigned char ambient_b, struct rc_light **lights, int lights_count) {
+	RC_PROFILE_BEGIN("rc_map_generate_lighting");
+	rc_counters_begin(RC_COUNTERS_LIGHTING);
 
 	// Ambient lighting
-	for (int i = 0; i < map->width * map->height; i++) {
-		map->lighting[3 * i + 0] = ambient_r;
-		map->lighting[3 * i + 1] = ambient_g;
-		map->lighting[3 * i + 2] = ambient_b;
-	}
+	const uint16_t ambient[4] = { ambient_r << RC_MAP_LIGHTING_FRACTION_BITS, ambient_g << RC_MAP_LIGHTING_FRACTION_BITS, ambient_b << RC_MAP_LIGHTING_FRACTION_BITS, 0 };
+	rc_kernels_get()->fill_lighting(map->accumulated_lighting, ambient, map->lighting_tiles_count);
 
-	// Per-light grid distance lighting
-	// TODO: Might be far more performant to have each light only recalculate its local lightmap when its properties change.
-	//       Then we only have to combine their local lightmaps into a global lightmap here every frame.
-	//       A lights local lightmap is only needs to be 4*range in size (if we use fancy indexing, else its range^2).
+	// Per-light lighting
 	for (int i = 0; i < lights_count; i++) {
+		struct rc_map_internal_light light;
+		rc_map_internal_read_light(lights[i], &light);
+		rc_map_internal_propagate_light(map, &light, NULL);
+	}
+
+	rc_map_internal_resolve_lighting(map, 0, map->lighting_tiles_count);
+	rc_counters_end(RC_COUNTERS_LIGHTING);
+	RC_PROFILE_END();
+}
 
-		int light_x, light_y;
-		unsigned char light_r, light_g, light_b;
-		int light_range;
-		double light_falloff;
-		rc_light_get_position(lights[i], &light_x, &light_y);
-		rc_light_get_color(lights[i], &light_r, &light_g, &light_b);
-		rc_light_get_lighting(lights[i], &light_range, &light_falloff);
+void rc_map_set_ambient_lighting(struct rc_map *map, unsigned char r, unsigned char g, unsigned char b) {
+	map->ambient[0] = r << RC_MAP_LIGHTING_FRACTION_BITS;
+	map->ambient[1] = g << RC_MAP_LIGHTING_FRACTION_BITS;
+	map->ambient[2] = b << RC_MAP_LIGHTING_FRACTION_BITS;
+	map->ambient[3] = 0;
+	rc_map_internal_invalidate_lighting(map, 0, 0, map->width - 1, map->height - 1);
+}
+
+void rc_map_add_light(struct rc_map *map, struct rc_light *light) {
+	if (map->lights_count == map->lights_capacity) {
+		map->lights_capacity = (map->lights_capacity) ? map->lights_capacity * 2 : 16;
+		struct rc_map_light_record *new_lights = realloc(map->lights, sizeof *new_lights * map->lights_capacity);
+		RC_ASSERT(new_lights);
+		map->lights = new_lights;
+	}
+	map->lights[map->lights_count++] = (struct rc_map_light_record) { light, .is_applied = false };
+}
 
-		// Skip disabled lights
-		if (light_range == 0)
+void rc_map_remove_light(struct rc_map *map, const struct rc_light *light) {
+	for (int i = 0; i < map->lights_count; i++) {
+		if (map->lights[i].light != light)
 			continue;
+		if (map->lights[i].is_applied)
+			rc_map_internal_invalidate_light(map, &map->lights[i].applied);
+		map->lights[i] = map->lights[--map->lights_count];
+		return;
+	}
+	rc_log(RC_LOG_WARN, "Attempted to remove a light which was never added to the map!");
+}
 
-		// A boolean array for marking visited tiles
-		bool *is_tile_visited = calloc(map->width * map->height, sizeof *is_tile_visited);
-		RC_ASSERT(is_tile_visited);
-		is_tile_visited[light_y * map->width + light_x] = true;
-
-		// Queue data structure for breadth first search
-		const int tile_queue_capacity = 4 * light_range;
-		int tile_queue_front_index = 0, tile_queue_back_index = 0;
-		int *tile_queue = malloc(sizeof *tile_queue * tile_queue_capacity * 2);
-		RC_ASSERT(tile_queue);
-		tile_queue[0] = light_x;
-		tile_queue[1] = light_y;
-
-		// Keep processing tiles until theres none left to process (either out of lighting range or all tiles have been visited)
-		int distance = 0, distance_tiles_remaining = 1;
-		while (distance <= light_range && tile_queue_front_index <= tile_queue_back_index) {
-
-			// Dequeue tile to process
-			const int dequeue_index = tile_queue_front_index++ % tile_queue_capacity * 2;
-			const int cur_tile_x = tile_queue[dequeue_index + 0];
-			const int cur_tile_y = tile_queue[dequeue_index + 1];
-
-			// Apply lighting of tile
-			const int lighting_index = 3 * (cur_tile_y * map->width + cur_tile_x);
-			double intensity = 1 - (double)distance / light_range; // lighting attenuation linear component
-			intensity = pow(intensity, light_falloff);             // lighting attenuation exponential component
-			map->lighting[lighting_index + 0] = fmin(0xff, map->lighting[lighting_index + 0] + light_r * intensity);
-			map->lighting[lighting_index + 1] = fmin(0xff, map->lighting[lighting_index + 1] + light_g * intensity);
-			map->lighting[lighting_index + 2] = fmin(0xff, map->lighting[lighting_index + 2] + light_b * intensity);
-
-			// Add valid surrounding tiles to the queue
-			const int adjacent_tile_step_x[4] = { 0, 1, 0, -1 };
-			const int adjacent_tile_step_y[4] = { 1, 0, -1, 0 };
-			for (int j = 0; j < 4; j++) {
-				const int next_tile_x = cur_tile_x + adjacent_tile_step_x[j];
-				const int next_tile_y = cur_tile_y + adjacent_tile_step_y[j];
-
-				// Don't process walls, tiles outside the map or already visited tiles
-				if (rc_map_get_wall(map, next_tile_x, next_tile_y) != -1)
-					continue;
-				if (is_tile_visited[next_tile_y * map->width + next_tile_x])
-					continue;
+void rc_map_update_lighting(struct rc_map *map) {
+	RC_PROFILE_BEGIN("rc_map_update_lighting");
+	rc_counters_begin(RC_COUNTERS_LIGHTING);
 
-				// Enqueue tile
-				is_tile_visited[next_tile_y * map->width + next_tile_x] = true;
-				const int enqueue_index = ++tile_queue_back_index % tile_queue_capacity * 2;
-				tile_queue[enqueue_index + 0] = next_tile_x;
-				tile_queue[enqueue_index + 1] = next_tile_y;
-			}
+	// Invalidate the tiles around lights which have changed since they were last applied, both where they were and where they are now
+	for (int i = 0; i < map->lights_count; i++) {
+		struct rc_map_light_record *record = &map->lights[i];
+		struct rc_map_internal_light current;
+		rc_map_internal_read_light(record->light, &current);
+		if (record->is_applied && rc_map_internal_is_same_light(&record->applied, &current))
+			continue;
+		if (record->is_applied)
+			rc_map_internal_invalidate_light(map, &record->applied);
+		rc_map_internal_invalidate_light(map, &current);
+		record->applied = current;
+		record->is_applied = true;
+	}
 
-			// Reduce the light intensity after all the tiles for this light intensity have been processed
-			if (--distance_tiles_remaining <= 0) {
-				distance_tiles_remaining = tile_queue_back_index - tile_queue_front_index + 1;
-				distance++;
-			}
+	if (map->dirty_rects_count == 0) {
+		rc_counters_end(RC_COUNTERS_LIGHTING);
+		RC_PROFILE_END();
+		return;
+	}
+
+	// Reset the invalidated tiles back to ambient
+	for (int y = map->dirty_min_y; y <= map->dirty_max_y; y++) {
+		for (int x = map->dirty_min_x; x <= map->dirty_max_x; x++) {
+			const int i = y * map->width + x;
+			if (!map->is_tile_dirty[i])
+				continue;
+			for (int j = 0; j < 4; j++)
+				map->accumulated_lighting[4 * i + j] = map->ambient[j];
 		}
+	}
 
-		free(is_tile_visited);
-		free(tile_queue);
+	// Relight the invalidated tiles with every light which reaches them
+	for (int i = 0; i < map->lights_count; i++) {
+		const struct rc_map_internal_light *light = &map->lights[i].applied;
+		for (int j = 0; j < map->dirty_rects_count; j++) {
+			const struct rc_map_rect *rect = &map->dirty_rects[j];
+			if (light->x + light->range < rect->min_x || light->x - light->range > rect->max_x || light->y + light->range < rect->min_y || light->y - light->range > rect->max_y)
+				continue;
+			rc_map_internal_propagate_light(map, light, map->is_tile_dirty);
+			break;
+		}
 	}
+
+	// Resolve and clear the invalidated region
+	for (int y = map->dirty_min_y; y <= map->dirty_max_y; y++) {
+		const int row_index = y * map->width;
+		rc_map_internal_resolve_lighting(map, row_index + map->dirty_min_x, map->dirty_max_x - map->dirty_min_x + 1);
+		for (int x = map->dirty_min_x; x <= map->dirty_max_x; x++)
+			map->is_tile_dirty[row_index + x] = false;
+	}
+	map->dirty_rects_count = 0;
+	rc_counters_end(RC_COUNTERS_LIGHTING);
+	RC_PROFILE_END();
 }
 
 void rc_map_get_lighting(const struct rc_map *map, int x, int y, unsigned char *r, unsigned char *g, unsigned char *b) {
 	if (x < 0 || x >= map->width || y < 0 || y >= map->height) {
 		rc_log(RC_LOG_WARN, "Attempted to get lighting for non-existant tile %i,%i!", x, y);
 		*r = *g = *b = 0x00;
+		return;
 	}
-	const int lighting_index = 3 * (y * map->width + x);
+	const int lighting_index = 4 * (y * map->width + x);
 	*r = map->lighting[lighting_index + 0];
 	*g = map->lighting[lighting_index + 1];
 	*b = map->lighting[lighting_index + 2];
@@ -166,6 +292,260 @@ void rc_map_destroy(struct rc_map *map) {
 	free(map->floor);
 	free(map->walls);
 	free(map->ceiling);
+	free(map->accumulated_lighting);
 	free(map->lighting);
+	free(map->lights);
+	free(map->is_tile_dirty);
+	free(map->dirty_rects);
+	free(map->is_light_tile_visited);
 	free(map);
 }
+
+static void rc_map_internal_read_light(const struct rc_light *light, struct rc_map_internal_light *internal_light) {
+	unsigned char r, g, b;
+	rc_light_get_position(light, &internal_light->x, &internal_light->y);
+	rc_light_get_color(light, &r, &g, &b);
+	rc_light_get_lighting(light, &internal_light->range, &internal_light->falloff);
+	internal_light->color[0] = r;
+	internal_light->color[1] = g;
+	internal_light->color[2] = b;
+	internal_light->color[3] = 0;
+}
+
+static bool rc_map_internal_is_same_light(const struct rc_map_internal_light *a, const struct rc_map_internal_light *b) {
+	return a->x == b->x && a->y == b->y && a->range == b->range && a->falloff == b->falloff
+		&& a->color[0] == b->color[0] && a->color[1] == b->color[1] && a->color[2] == b->color[2];
+}
+
+// Lights never reach further than their range along either axis
+static void rc_map_internal_invalidate_light(struct rc_map *map, const struct rc_map_internal_light *light) {
+	if (light->range > 0)
+		rc_map_internal_invalidate_lighting(map, light->x - light->range, light->y - light->range, light->x + light->range, light->y + light->range);
+}
+
+static void rc_map_internal_invalidate_lighting(struct rc_map *map, int min_x, int min_y, int max_x, int max_y) {
+	min_x = (min_x < 0) ? 0 : min_x;
+	min_y = (min_y < 0) ? 0 : min_y;
+	max_x = (max_x >= map->width) ? map->width - 1 : max_x;
+	max_y = (max_y >= map->height) ? map->height - 1 : max_y;
+	if (min_x > max_x || min_y > max_y)
+		return;
+
+	for (int y = min_y; y <= max_y; y++)
+		for (int x = min_x; x <= max_x; x++)
+			map->is_tile_dirty[y * map->width + x] = true;
+
+	// Track the rects so lights can be tested against them, and their bounds so only that region is reset and resolved
+	if (map->dirty_rects_count == map->dirty_rects_capacity) {
+		map->dirty_rects_capacity = (map->dirty_rects_capacity) ? map->dirty_rects_capacity * 2 : 16;
+		struct rc_map_rect *new_dirty_rects = realloc(map->dirty_rects, sizeof *new_dirty_rects * map->dirty_rects_capacity);
+		RC_ASSERT(new_dirty_rects);
+		map->dirty_rects = new_dirty_rects;
+	}
+	map->dirty_rects[map->dirty_rects_count++] = (struct rc_map_rect) { min_x, min_y, max_x, max_y };
+	if (map->dirty_rects_count == 1) {
+		map->dirty_min_x = min_x;
+		map->dirty_min_y = min_y;
+		map->dirty_max_x = max_x;
+		map->dirty_max_y = max_y;
+	} else {
+		map->dirty_min_x = (min_x < map->dirty_min_x) ? min_x : map->dirty_min_x;
+		map->dirty_min_y = (min_y < map->dirty_min_y) ? min_y : map->dirty_min_y;
+		map->dirty_max_x = (max_x > map->dirty_max_x) ? max_x : map->dirty_max_x;
+		map->dirty_max_y = (max_y > map->dirty_max_y) ? max_y : map->dirty_max_y;
+	}
+}
+
+// Resolve the accumulated lighting down to the 8-bit lightmap, saturating overbright tiles
+static void rc_map_internal_resolve_lighting(const struct rc_map *map, int first_tile, int tiles_count) {
+	rc_kernels_get()->resolve_lighting(map->lighting + 4 * first_tile, map->accumulated_lighting + 4 * first_tile, RC_MAP_LIGHTING_FRACTION_BITS, tiles_count);
+}
+
+// Add a lights contribution to the accumulated lighting, only writing to tiles in the mask if one is given
+static void rc_map_internal_propagate_light(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask) {
+
+	// Skip disabled lights and lights outside the map
+	if (light->range == 0)
+		return;
+	if (light->x < 0 || light->x >= map->width || light->y < 0 || light->y >= map->height)
+		return;
+
+	switch (map->lighting_mode) {
+		case RC_MAP_LIGHTING_FLOOD:
+			rc_map_internal_flood_light(map, light, mask);
+			break;
+		case RC_MAP_LIGHTING_SHADOWCAST:
+			rc_map_internal_shadowcast_light(map, light, mask);
+			break;
+	}
+}
+
+// Clear the visited tiles for a light, only the box it can reach is used so the cost is bounded by range^2 rather than the map size
+static bool *rc_map_internal_begin_light_visit(const struct rc_map *map, const struct rc_map_internal_light *light, struct rc_map_rect *range_box) {
+	range_box->min_x = (light->x - light->range < 0) ? 0 : light->x - light->range;
+	range_box->min_y = (light->y - light->range < 0) ? 0 : light->y - light->range;
+	range_box->max_x = (light->x + light->range >= map->width) ? map->width - 1 : light->x + light->range;
+	range_box->max_y = (light->y + light->range >= map->height) ? map->height - 1 : light->y + light->range;
+	const int range_box_width = range_box->max_x - range_box->min_x + 1, range_box_height = range_box->max_y - range_box->min_y + 1;
+	memset(map->is_light_tile_visited, 0, sizeof *map->is_light_tile_visited * range_box_width * range_box_height);
+	return map->is_light_tile_visited;
+}
+
+static void rc_map_internal_apply_light(const struct rc_map *map, int x, int y, const struct rc_map_internal_light *light, double distance, const bool *mask) {
+	if (mask && !mask[y * map->width + x])
+		return;
+
+	double intensity = 1 - distance / light->range; // lighting attenuation linear component
+	intensity = pow(intensity, light->falloff);     // lighting attenuation exponential component
+
+	// Scale the lights color by the intensity in 8.8 fixed point and add it to the tile with saturation
+	const uint16_t intensity_fixed = intensity * 0x100 + 0.5;
+	uint16_t *accumulated = map->accumulated_lighting + 4 * (y * map->width + x);
+#ifdef __SSE2__
+	const __m128i color = _mm_loadl_epi64((const __m128i *)light->color);
+	const __m128i contribution = _mm_srli_epi16(_mm_mullo_epi16(color, _mm_set1_epi16(intensity_fixed)), 8 - RC_MAP_LIGHTING_FRACTION_BITS);
+	_mm_storel_epi64((__m128i *)accumulated, _mm_adds_epu16(_mm_loadl_epi64((const __m128i *)accumulated), contribution));
+#else
+	for (int i = 0; i < 3; i++) {
+		const int sum = accumulated[i] + (light->color[i] * intensity_fixed >> (8 - RC_MAP_LIGHTING_FRACTION_BITS));
+		accumulated[i] = (sum > 0xffff) ? 0xffff : sum;
+	}
+#endif
+}
+
+// Grid distance lighting - light flows around corners, cost grows with the reachable area
+static void rc_map_internal_flood_light(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask) {
+
+	// A boolean array for marking visited tiles - tiles outside the range box are further than the range so are never visited
+	struct rc_map_rect range_box;
+	bool *is_tile_visited = rc_map_internal_begin_light_visit(map, light, &range_box);
+	const int range_box_width = range_box.max_x - range_box.min_x + 1;
+	is_tile_visited[(light->y - range_box.min_y) * range_box_width + light->x - range_box.min_x] = true;
+
+	// Queue data structure for breadth first search
+	const int tile_queue_capacity = 4 * light->range;
+	int tile_queue_front_index = 0, tile_queue_back_index = 0;
+	int *tile_queue = malloc(sizeof *tile_queue * tile_queue_capacity * 2);
+	RC_ASSERT(tile_queue);
+	tile_queue[0] = light->x;
+	tile_queue[1] = light->y;
+
+	// Keep processing tiles until theres none left to process (either out of lighting range or all tiles have been visited)
+	int distance = 0, distance_tiles_remaining = 1;
+	while (distance <= light->range && tile_queue_front_index <= tile_queue_back_index) {
+
+		// Dequeue tile to process
+		const int dequeue_index = tile_queue_front_index++ % tile_queue_capacity * 2;
+		const int cur_tile_x = tile_queue[dequeue_index + 0];
+		const int cur_tile_y = tile_queue[dequeue_index + 1];
+
+		// Apply lighting of tile
+		rc_map_internal_apply_light(map, cur_tile_x, cur_tile_y, light, distance, mask);
+
+		// Add valid surrounding tiles to the queue
+		const int adjacent_tile_step_x[4] = { 0, 1, 0, -1 };
+		const int adjacent_tile_step_y[4] = { 1, 0, -1, 0 };
+		for (int j = 0; j < 4; j++) {
+			const int next_tile_x = cur_tile_x + adjacent_tile_step_x[j];
+			const int next_tile_y = cur_tile_y + adjacent_tile_step_y[j];
+
+			// Don't process tiles out of range (including those outside the map), walls or already visited tiles
+			if (next_tile_x < range_box.min_x || next_tile_x > range_box.max_x || next_tile_y < range_box.min_y || next_tile_y > range_box.max_y)
+				continue;
+			if (map->walls[next_tile_y * map->width + next_tile_x] != -1)
+				continue;
+			const int visited_index = (next_tile_y - range_box.min_y) * range_box_width + next_tile_x - range_box.min_x;
+			if (is_tile_visited[visited_index])
+				continue;
+
+			// Enqueue tile
+			is_tile_visited[visited_index] = true;
+			const int enqueue_index = ++tile_queue_back_index % tile_queue_capacity * 2;
+			tile_queue[enqueue_index + 0] = next_tile_x;
+			tile_queue[enqueue_index + 1] = next_tile_y;
+		}
+
+		// Reduce the light intensity after all the tiles for this light intensity have been processed
+		if (--distance_tiles_remaining <= 0) {
+			distance_tiles_remaining = tile_queue_back_index - tile_queue_front_index + 1;
+			distance++;
+		}
+	}
+
+	free(tile_queue);
+}
+
+// Line of sight lighting - only tiles visible from the light within its range are lit, so cost is bounded by range^2
+static void rc_map_internal_shadowcast_light(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask) {
+
+	// A boolean array for marking lit tiles within range of the light - octants share their edges so tiles can be visited twice
+	struct rc_map_rect range_box;
+	bool *is_tile_lit = rc_map_internal_begin_light_visit(map, light, &range_box);
+
+	// Transformations from octant-local coordinates to map coordinates
+	const int octant_transforms[8][4] = {
+		{ 1, 0, 0, 1 }, { 0, 1, 1, 0 }, { 0, -1, 1, 0 }, { -1, 0, 0, 1 },
+		{ -1, 0, 0, -1 }, { 0, -1, -1, 0 }, { 0, 1, -1, 0 }, { 1, 0, 0, -1 }
+	};
+
+	rc_map_internal_apply_light(map, light->x, light->y, light, 0, mask);
+	is_tile_lit[(light->y - range_box.min_y) * (range_box.max_x - range_box.min_x + 1) + light->x - range_box.min_x] = true;
+	for (int i = 0; i < 8; i++) {
+		const int *t = octant_transforms[i];
+		rc_map_internal_shadowcast_octant(map, light, mask, is_tile_lit, &range_box, 1, 1.0, 0.0, t[0], t[1], t[2], t[3]);
+	}
+}
+
+// Recursive shadowcasting of a single octant between start_slope and end_slope, beginning at the given row
+static void rc_map_internal_shadowcast_octant(const struct rc_map *map, const struct rc_map_internal_light *light, const bool *mask, bool *is_tile_lit, const struct rc_map_rect *range_box, int row, double start_slope, double end_slope, int xx, int xy, int yx, int yy) {
+	if (start_slope < end_slope)
+		return;
+
+	const int range_box_width = range_box->max_x - range_box->min_x + 1;
+	double next_start_slope = start_slope;
+	for (int distance = row; distance <= light->range; distance++) {
+		bool is_blocked = false;
+		for (int dx = -distance, dy = -distance; dx <= 0; dx++) {
+
+			// Slopes of the left and right edges of this tile
+			const double left_slope = (dx - 0.5) / (dy + 0.5);
+			const double right_slope = (dx + 0.5) / (dy - 0.5);
+			if (start_slope < right_slope)
+				continue;
+			if (end_slope > left_slope)
+				break;
+
+			// Treat tiles outside the map as walls
+			const int offset_x = dx * xx + dy * xy, offset_y = dx * yx + dy * yy;
+			const int tile_x = light->x + offset_x, tile_y = light->y + offset_y;
+			const bool is_outside = tile_x < 0 || tile_x >= map->width || tile_y < 0 || tile_y >= map->height;
+			const bool is_wall = is_outside || map->walls[tile_y * map->width + tile_x] != -1;
+
+			// Apply lighting of visible open tiles within the lights radius
+			const int lit_index = (tile_y - range_box->min_y) * range_box_width + tile_x - range_box->min_x;
+			const double tile_distance = sqrt(dx * dx + dy * dy);
+			if (!is_wall && tile_distance <= light->range && !is_tile_lit[lit_index]) {
+				is_tile_lit[lit_index] = true;
+				rc_map_internal_apply_light(map, tile_x, tile_y, light, tile_distance, mask);
+			}
+
+			// Walls cast shadows over the rest of the octant - scan the unblocked section beyond them in a child scan
+			if (is_blocked) {
+				if (is_wall) {
+					next_start_slope = right_slope;
+					continue;
+				}
+				is_blocked = false;
+				start_slope = next_start_slope;
+			} else if (is_wall && distance < light->range) {
+				is_blocked = true;
+				rc_map_internal_shadowcast_octant(map, light, mask, is_tile_lit, range_box, distance + 1, start_slope, left_slope, xx, xy, yx, yy);
+				next_start_slope = right_slope;
+			}
+		}
+
+		// The whole row was blocked, nothing more can be seen
+		if (is_blocked)
+			break;
+	}
+}
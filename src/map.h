@@ -4,12 +4,23 @@
 struct rc_light;
 struct rc_map;
 
+enum rc_map_lighting_mode {
+	RC_MAP_LIGHTING_FLOOD = 0,
+	RC_MAP_LIGHTING_SHADOWCAST
+};
+
 struct rc_map *rc_map_create(int map_width, int map_height, const int *floor, const int *walls, const int *ceiling);
 void rc_map_get_size(const struct rc_map *map, int *width, int *height);
 int rc_map_get_floor(const struct rc_map *map, int x, int y);
 int rc_map_get_wall(const struct rc_map *map, int x, int y);
 int rc_map_get_ceiling(const struct rc_map *map, int x, int y);
+void rc_map_raycast(const struct rc_map *map, double x, double y, double a, int *hit_x, int *hit_y, int *hit_side, double *hit_dst, double *hit_lat);
+void rc_map_set_lighting_mode(struct rc_map *map, enum rc_map_lighting_mode mode);
 void rc_map_generate_lighting(const struct rc_map *map, unsigned char ambient_r, unsigned char ambient_g, unsigned char ambient_b, struct rc_light **lights, int lights_count);
+void rc_map_set_ambient_lighting(struct rc_map *map, unsigned char r, unsigned char g, unsigned char b);
+void rc_map_add_light(struct rc_map *map, struct rc_light *light);
+void rc_map_remove_light(struct rc_map *map, const struct rc_light *light);
+void rc_map_update_lighting(struct rc_map *map);
 void rc_map_get_lighting(const struct rc_map *map, int x, int y, unsigned char *r, unsigned char *g, unsigned char *b);
 void rc_map_destroy(struct rc_map *map);
 
@@ -3,11 +3,11 @@
 #include "error.h"
 #include "input.h"
 #include "entity.h"
-#include "map.h"
 #include <stdlib.h>
 #include <stdbool.h>
 #include <math.h>
 
+#define player_radius 0.2
 #define player_normal_height 0.5
 #define player_crawl_height 0.1
 #define player_height_speed 0.25
@@ -29,17 +29,18 @@ struct rc_player_data {
 	int movement_ticks;
 };
 
-void rc_player_init(struct rc_entity *player) {
+void rc_player_init(struct rc_entity_pool *pool, struct rc_entity_handle player) {
 	rc_log(RC_LOG_VERBOSE, "Initializing new player...");
 	struct rc_player_data *player_data = calloc(1, sizeof *player_data);
 	RC_ASSERT(player_data);
-	rc_entity_set_data_pointer(player, player_data);
+	rc_entity_set_data_pointer(pool, player, player_data);
+	rc_entity_set_radius(pool, player, player_radius);
 }
 
-void rc_player_update(struct rc_entity *player, struct rc_map *map) {
+void rc_player_update(struct rc_entity_pool *pool, struct rc_entity_handle player, const struct rc_map *map) {
 	double player_x, player_y, player_z, player_r;
-	rc_entity_get_transform(player, &player_x, &player_y, &player_z, &player_r);
-	struct rc_player_data *player_data = rc_entity_get_data_pointer(player);
+	rc_entity_get_transform(pool, player, &player_x, &player_y, &player_z, &player_r);
+	struct rc_player_data *player_data = rc_entity_get_data_pointer(pool, player);
 
 	// Crawling
 	const bool is_crawling = rc_input_is_key_down(RC_INPUT_KEY_SHIFT);
@@ -64,11 +65,9 @@ void rc_player_update(struct rc_entity *player, struct rc_map *map) {
 	player_data->vel_x = player_data->vel_x * (1 - accel) + target_vel_x * accel;
 	player_data->vel_y = player_data->vel_y * (1 - accel) + target_vel_y * accel;
 
-	// Check for collision before applying velocity
-	if (rc_map_get_wall(map, floor(player_x + player_data->vel_x), player_y) == -1)
-		player_x += player_data->vel_x;
-	if (rc_map_get_wall(map, player_x, floor(player_y + player_data->vel_y)) == -1)
-		player_y += player_data->vel_y;
+	// Walls stop the player when the move is committed
+	player_x += player_data->vel_x;
+	player_y += player_data->vel_y;
 
 	// Head bobbing
 	player_data->movement_ticks++;
@@ -79,10 +78,10 @@ void rc_player_update(struct rc_entity *player, struct rc_map *map) {
 	const double mag = (is_crawling) ? player_crawl_bobbing_mag : player_normal_bobbing_mag;
 	player_z += sin(player_data->movement_ticks * freq) * mag * vel_mag / max_speed;
 
-	rc_entity_set_transform(player, player_x, player_y, player_z, player_r);
+	rc_entity_set_transform(pool, player, player_x, player_y, player_z, player_r);
 }
 
-void rc_player_destroy(struct rc_entity *player) {
+void rc_player_destroy(struct rc_entity_pool *pool, struct rc_entity_handle player) {
 	rc_log(RC_LOG_VERBOSE, "Destroying player...");
-	free(rc_entity_get_data_pointer(player));
+	free(rc_entity_get_data_pointer(pool, player));
 }
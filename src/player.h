@@ -1,11 +1,12 @@
 #ifndef RC_PLAYER_H
 #define RC_PLAYER_H
 
-struct rc_entity;
+#include "entity.h"
+
 struct rc_map;
 
-void rc_player_init(struct rc_entity *player);
-void rc_player_update(struct rc_entity *player, struct rc_map *map);
-void rc_player_destroy(struct rc_entity *player);
+void rc_player_init(struct rc_entity_pool *pool, struct rc_entity_handle player);
+void rc_player_update(struct rc_entity_pool *pool, struct rc_entity_handle player, const struct rc_map *map);
+void rc_player_destroy(struct rc_entity_pool *pool, struct rc_entity_handle player);
 
 #endif
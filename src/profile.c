@@ -0,0 +1,127 @@
+#include "profile.h"
+#include "logging.h"
+#include "error.h"
+#include "timer.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Each thread records finished zones into its own buffer, so zones never contend with each other
+// Buffers are only shared when a thread first records a zone, and when they are exported
+// Registering a thread happens once per thread, so it is guarded by a spinlock which works on every platform
+
+#define RC_PROFILE_MAX_EVENTS 65536
+#define RC_PROFILE_MAX_DEPTH 64
+
+struct rc_profile_event {
+	const char *name;
+	double begin_time, end_time;
+};
+
+struct rc_profile_thread {
+	int id;
+	int events_count, dropped_events_count;
+	struct rc_profile_event events[RC_PROFILE_MAX_EVENTS];
+	int depth;
+	struct rc_profile_event open_zones[RC_PROFILE_MAX_DEPTH];
+	struct rc_profile_thread *next;
+};
+
+static struct rc_timer *profile_timer;
+static struct rc_profile_thread *threads;
+static int threads_count;
+static _Thread_local struct rc_profile_thread *current_thread;
+static atomic_flag threads_lock = ATOMIC_FLAG_INIT;
+
+static struct rc_profile_thread *rc_profile_internal_get_thread(void);
+static void rc_profile_internal_write_string(FILE *file, const char *string);
+
+void rc_profile_init(void) {
+	rc_log(RC_LOG_INFO, "Initializing profiler...");
+	profile_timer = rc_timer_create();
+}
+
+void rc_profile_begin(const char *name) {
+	struct rc_profile_thread *thread = rc_profile_internal_get_thread();
+	RC_ASSERT(thread->depth < RC_PROFILE_MAX_DEPTH);
+	thread->open_zones[thread->depth++] = (struct rc_profile_event) { name, rc_timer_measure(profile_timer) };
+}
+
+// Ends the most recently begun zone on this thread
+void rc_profile_end(void) {
+	struct rc_profile_thread *thread = rc_profile_internal_get_thread();
+	RC_ASSERT(thread->depth > 0);
+	struct rc_profile_event event = thread->open_zones[--thread->depth];
+	event.end_time = rc_timer_measure(profile_timer);
+	if (thread->events_count == RC_PROFILE_MAX_EVENTS)
+		thread->dropped_events_count++;
+	else
+		thread->events[thread->events_count++] = event;
+}
+
+// Write every recorded zone as Chrome trace event JSON, which can be opened in chrome://tracing or Perfetto
+// Other threads must not be recording zones while exporting
+void rc_profile_export(const char *filename) {
+	rc_log(RC_LOG_INFO, "Exporting profile to '%s'...", filename);
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		rc_log(RC_LOG_WARN, "Unable to open '%s' for writing", filename);
+		return;
+	}
+
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+	bool is_first_event = true;
+	for (const struct rc_profile_thread *thread = threads; thread; thread = thread->next) {
+		if (thread->dropped_events_count)
+			rc_log(RC_LOG_WARN, "Profiler thread %i dropped %i zones", thread->id, thread->dropped_events_count);
+		for (int i = 0; i < thread->events_count; i++) {
+			const struct rc_profile_event *event = &thread->events[i];
+			fputs((is_first_event) ? "\n{\"name\":" : ",\n{\"name\":", file);
+			rc_profile_internal_write_string(file, event->name);
+			fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}", thread->id, event->begin_time * 1e6, (event->end_time - event->begin_time) * 1e6);
+			is_first_event = false;
+		}
+	}
+	fputs("\n]}\n", file);
+	if (fclose(file))
+		rc_log(RC_LOG_WARN, "Unable to write '%s'", filename);
+}
+
+void rc_profile_cleanup(void) {
+	rc_log(RC_LOG_INFO, "Cleaning up profiler...");
+	while (threads) {
+		struct rc_profile_thread *next = threads->next;
+		free(threads);
+		threads = next;
+	}
+	threads_count = 0;
+	current_thread = NULL;
+	rc_timer_destroy(profile_timer);
+}
+
+// Threads get their buffer the first time they record a zone
+static struct rc_profile_thread *rc_profile_internal_get_thread(void) {
+	if (current_thread)
+		return current_thread;
+	struct rc_profile_thread *thread = malloc(sizeof *thread);
+	RC_ASSERT(thread);
+	thread->events_count = thread->dropped_events_count = thread->depth = 0;
+	while (atomic_flag_test_and_set_explicit(&threads_lock, memory_order_acquire));
+	thread->id = threads_count++;
+	thread->next = threads;
+	threads = thread;
+	atomic_flag_clear_explicit(&threads_lock, memory_order_release);
+	return current_thread = thread;
+}
+
+static void rc_profile_internal_write_string(FILE *file, const char *string) {
+	fputc('"', file);
+	for (const char *c = string; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fputc('\\', file);
+		if ((unsigned char) *c >= 0x20)
+			fputc(*c, file);
+	}
+	fputc('"', file);
+}
@@ -0,0 +1,26 @@
+#ifndef RC_PROFILE_H
+#define RC_PROFILE_H
+
+// Profiling zones are only compiled in when building with RC_PROFILE defined, otherwise they cost nothing
+// Zones nest, and each thread records its own zones
+#ifdef RC_PROFILE
+#define RC_PROFILE_INIT() rc_profile_init()
+#define RC_PROFILE_BEGIN(name) rc_profile_begin(name)
+#define RC_PROFILE_END() rc_profile_end()
+#define RC_PROFILE_EXPORT(filename) rc_profile_export(filename)
+#define RC_PROFILE_CLEANUP() rc_profile_cleanup()
+#else
+#define RC_PROFILE_INIT()
+#define RC_PROFILE_BEGIN(name)
+#define RC_PROFILE_END()
+#define RC_PROFILE_EXPORT(filename)
+#define RC_PROFILE_CLEANUP()
+#endif
+
+void rc_profile_init(void);
+void rc_profile_begin(const char *name);
+void rc_profile_end(void);
+void rc_profile_export(const char *filename);
+void rc_profile_cleanup(void);
+
+#endif
@@ -6,25 +6,90 @@
 #include "map.h"
 #include "entity.h"
 #include "texture.h"
+#include "profile.h"
+#include "counters.h"
+#include "kernels.h"
+#include "jobs.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #define GLAD_GL_IMPLEMENTATION
 #include <glad/gl.h>
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
+// Lit palettes are cached per tile, so columns alternating between a few walls don't relight a palette each time
+#define RC_RENDERER_LIT_PALETTES_COUNT 8
+
+// Quantized textures can be drawn through a copy of their palette with lighting already applied
+struct rc_renderer_lit_palette {
+	const struct rc_texture *texture;
+	unsigned char light[4];
+	unsigned char colors[256 * 4];
+};
+
+// A tile is a strip of columns the full height of the screen, and drawing one only changes its own columns and lit palettes
+// Lit palettes are replaced oldest first once they are all in use
+struct rc_renderer_tile {
+	int first_column, end_column;
+	int next_lit_palette;
+	struct rc_renderer_lit_palette lit_palettes[RC_RENDERER_LIT_PALETTES_COUNT];
+};
+
+// A visible entity placed on-screen, once per frame, so tiles only need to clip it to their own columns
+// first to last is the range of the texture on-screen, and tex_base accounts for the texture beginning off-screen
+struct rc_renderer_sprite {
+	const struct rc_texture *texture;
+	const struct rc_kernels_spans *span_kernels;
+	unsigned char light[4];
+	double depth;
+	int tex_width, tex_height;
+	double texels_per_column, texels_per_row;
+	int first_column, tex_base_column, last_column;
+	int first_row, tex_base_row, last_row;
+};
+
+struct rc_renderer_frame {
+	const struct rc_renderer *renderer;
+	unsigned char *pixels;
+	const struct rc_map *map;
+	double cam_x, cam_y, cam_z, cam_r;
+};
+
 struct rc_renderer {
 	const struct rc_window *window;
 	double aspect, fov;
 	struct rc_texture **wall_textures;
+	int wall_textures_size_shift;
 	int num_columns, num_rows;
+	int passes;
+	bool is_palettized, is_column_major;
+	int row_stride, column_stride;
+	unsigned char *headless_pixels, *column_major_pixels;
 	double *zbuffer;
+	unsigned char *row_colors, *row_lights;
+	int *visible_entities;
+	struct rc_renderer_sprite *sprites;
+	int sprites_count, visible_entities_capacity;
+	int tile_columns, tiles_count;
+	struct rc_renderer_tile *tiles;
+	struct rc_job_system *jobs;
 	unsigned vao, vbo, ibo;
 	unsigned tex, double_pbo[2], shader;
 	int current_pbo;
 };
 
-static void rc_renderer_internal_raycast(const struct rc_map *map, double x, double y, double a, int *hit_x, int *hit_y, int *hit_side, double *hit_dst, double *hit_lat);
+static const unsigned char *rc_renderer_internal_get_lit_palette(struct rc_renderer_tile *tile, const struct rc_texture *texture, const unsigned char *light);
+static void rc_renderer_internal_clear_lit_palettes(struct rc_renderer_tile *tile);
+static void rc_renderer_internal_resize_tiles(struct rc_renderer *renderer);
+static void rc_renderer_internal_resize_frame(struct rc_renderer *renderer);
+static void rc_renderer_internal_draw_frame(struct rc_renderer *renderer, unsigned char *pixels, const struct rc_map *map, const struct rc_entity_pool *entities, struct rc_entity_handle camera, double alpha);
+static void rc_renderer_internal_draw_tile(void *frame, int tile_index);
+static void rc_renderer_internal_find_visible_entities(struct rc_renderer *renderer, const struct rc_map *map, const struct rc_entity_pool *entities, double alpha, double cam_x, double cam_y, double cam_z, double cam_r);
+static int rc_renderer_internal_compare_sprites(const void *a, const void *b);
+static void rc_renderer_internal_draw_floor_and_ceiling(const struct rc_renderer *renderer, struct rc_renderer_tile *tile, unsigned char *pixels, const struct rc_map *map, double cam_x, double cam_y, double cam_z, double cam_r);
+static void rc_renderer_internal_draw_walls(const struct rc_renderer *renderer, struct rc_renderer_tile *tile, unsigned char *pixels, const struct rc_map *map, double cam_x, double cam_y, double cam_z, double cam_r);
+static void rc_renderer_internal_draw_sprites(const struct rc_renderer *renderer, struct rc_renderer_tile *tile, unsigned char *pixels);
 static void rc_renderer_internal_initialize_opengl(struct rc_renderer *renderer);
 static void rc_renderer_internal_resize_opengl_buffers(struct rc_renderer *renderer);
 static unsigned rc_renderer_internal_create_shader(const char *filepath, GLenum shader_type);
@@ -33,19 +98,33 @@ static unsigned rc_renderer_internal_create_shader_program(const unsigned shader
 static void rc_renderer_internal_opengl_message_callback(GLenum source, GLenum type, unsigned id, GLenum severity, GLsizei length, const GLchar *message, const void *userParam);
 #endif
 
-struct rc_renderer *rc_renderer_create(const struct rc_window *window, double aspect, int resolution, double fov, struct rc_texture **wall_textures) {
+struct rc_renderer *rc_renderer_create(const struct rc_window *window, double aspect, int resolution, double fov, struct rc_texture **wall_textures, int wall_textures_count) {
 	rc_log(RC_LOG_INFO, "Creating new renderer...");
 	struct rc_renderer *renderer = malloc(sizeof *renderer);
 	RC_ASSERT(renderer);
 	*renderer = (struct rc_renderer) { window, aspect };
 	rc_renderer_internal_initialize_opengl(renderer);
+	rc_renderer_set_passes(renderer, RC_RENDERER_PASS_ALL);
 	rc_renderer_set_fov(renderer, fov);
-	rc_renderer_set_wall_textures(renderer, wall_textures);
+	rc_renderer_set_wall_textures(renderer, wall_textures, wall_textures_count);
 	rc_renderer_set_resolution(renderer, resolution);
 	rc_window_set_renderer(window, renderer);
 	return renderer;
 }
 
+// Headless renderers draw into memory instead of a window, so they need no OpenGL context
+struct rc_renderer *rc_renderer_create_headless(double aspect, int resolution, double fov, struct rc_texture **wall_textures, int wall_textures_count) {
+	rc_log(RC_LOG_INFO, "Creating new headless renderer...");
+	struct rc_renderer *renderer = malloc(sizeof *renderer);
+	RC_ASSERT(renderer);
+	*renderer = (struct rc_renderer) { NULL, aspect };
+	rc_renderer_set_passes(renderer, RC_RENDERER_PASS_ALL);
+	rc_renderer_set_fov(renderer, fov);
+	rc_renderer_set_wall_textures(renderer, wall_textures, wall_textures_count);
+	rc_renderer_set_resolution(renderer, resolution);
+	return renderer;
+}
+
 void rc_renderer_set_dimensions(const struct rc_renderer *renderer, int width, int height) {
 	rc_log(RC_LOG_INFO, "Setting renderer dimensions to %ix%i...", width, height);
 	double xratio = renderer->aspect * height / width;
@@ -71,85 +150,421 @@ void rc_renderer_set_resolution(struct rc_renderer *renderer, int resolution) {
 	RC_ASSERT(resolution >= 1);
 	renderer->num_columns = renderer->aspect * resolution;
 	renderer->num_rows = resolution;
-	rc_renderer_internal_resize_opengl_buffers(renderer);
+
+	// Resize the zbuffer
+	double *new_zbuffer = realloc(renderer->zbuffer, sizeof *new_zbuffer * renderer->num_columns);
+	RC_ASSERT(new_zbuffer);
+	renderer->zbuffer = new_zbuffer;
+
+	// Resize the rows of samples the floor and ceiling are lit from
+	unsigned char *new_row_colors = realloc(renderer->row_colors, 4 * sizeof *new_row_colors * renderer->num_columns);
+	unsigned char *new_row_lights = realloc(renderer->row_lights, 4 * sizeof *new_row_lights * renderer->num_columns);
+	RC_ASSERT(new_row_colors && new_row_lights);
+	renderer->row_colors = new_row_colors;
+	renderer->row_lights = new_row_lights;
+	rc_renderer_internal_resize_tiles(renderer);
+	rc_renderer_internal_resize_frame(renderer);
 }
 
-void rc_renderer_set_wall_textures(struct rc_renderer *renderer, struct rc_texture **wall_textures) {
+// Wall textures all of one square power-of-two size let the floor and ceiling find texels without looking up their dimensions
+void rc_renderer_set_wall_textures(struct rc_renderer *renderer, struct rc_texture **wall_textures, int wall_textures_count) {
 	rc_log(RC_LOG_INFO, "Setting renderer wall textures...");
 	renderer->wall_textures = wall_textures;
+	renderer->wall_textures_size_shift = 0;
+	int first_width, first_height;
+	rc_texture_get_dimensions(wall_textures[0], &first_width, &first_height);
+	bool is_shared_size = first_width == first_height && (first_width & (first_width - 1)) == 0;
+	for (int i = 1; i < wall_textures_count && is_shared_size; i++) {
+		int tex_width, tex_height;
+		rc_texture_get_dimensions(wall_textures[i], &tex_width, &tex_height);
+		is_shared_size = tex_width == first_width && tex_height == first_height;
+	}
+	if (is_shared_size)
+		while ((1 << renderer->wall_textures_size_shift) < first_width)
+			renderer->wall_textures_size_shift++;
+	rc_log(RC_LOG_VERBOSE, "Wall textures %s share a power-of-two size.", (is_shared_size) ? "do" : "don't");
+}
+
+// Draw quantized textures through their palettes - faster as a quarter of the texture data is read, but lower quality
+void rc_renderer_set_palettized(struct rc_renderer *renderer, bool is_palettized) {
+	rc_log(RC_LOG_INFO, "Setting renderer palettized textures %s...", (is_palettized) ? "on" : "off");
+	renderer->is_palettized = is_palettized;
+}
+
+// Skipping passes lets the others be measured on their own
+void rc_renderer_set_passes(struct rc_renderer *renderer, int passes) {
+	rc_log(RC_LOG_INFO, "Setting renderer passes to %#x...", passes);
+	RC_ASSERT((passes & ~RC_RENDERER_PASS_ALL) == 0);
+	renderer->passes = passes;
+}
+
+// Draw into a column-major frame, so walls and sprites are drawn down contiguous memory rather than a row apart
+void rc_renderer_set_column_major(struct rc_renderer *renderer, bool is_column_major) {
+	rc_log(RC_LOG_INFO, "Setting renderer column-major frame %s...", (is_column_major) ? "on" : "off");
+	renderer->is_column_major = is_column_major;
+	rc_renderer_internal_resize_frame(renderer);
+}
+
+// Draw the screen in tiles of this many columns, or all at once if 0 - tiles are drawn with the job system if one is given
+// Each tile draws every pass before moving on, so the part of the frame being drawn stays in cache
+void rc_renderer_set_tiles(struct rc_renderer *renderer, int tile_columns, struct rc_job_system *jobs) {
+	rc_log(RC_LOG_INFO, "Setting renderer tiles to %i columns...", tile_columns);
+	RC_ASSERT(tile_columns >= 0);
+	renderer->tile_columns = tile_columns;
+	renderer->jobs = jobs;
+	rc_renderer_internal_resize_tiles(renderer);
 }
 
-void rc_renderer_draw(struct rc_renderer *renderer, const struct rc_map *map, struct rc_entity **entities, int entities_count, const struct rc_entity *camera) {
+void rc_renderer_draw(struct rc_renderer *renderer, const struct rc_map *map, const struct rc_entity_pool *entities, struct rc_entity_handle camera, double alpha) {
+
+	RC_PROFILE_BEGIN("rc_renderer_draw");
+
+	// Headless renderers keep the frame in memory - clear it so pixels outside the map are the same every frame
+	// Column-major frames are transposed afterwards, so the headless frame is always row-major
+	if (!renderer->window) {
+		unsigned char *pixels = (renderer->is_column_major) ? renderer->column_major_pixels : renderer->headless_pixels;
+		memset(pixels, 0, 4 * sizeof *pixels * renderer->num_columns * renderer->num_rows);
+		rc_renderer_internal_draw_frame(renderer, pixels, map, entities, camera, alpha);
+		if (renderer->is_column_major) {
+			RC_PROFILE_BEGIN("transpose");
+			rc_kernels_get()->transpose(renderer->headless_pixels, renderer->column_major_pixels, renderer->num_columns, renderer->num_rows);
+			RC_PROFILE_END();
+		}
+		RC_PROFILE_END();
+		return;
+	}
 
 	// Render with the current PBO
+	RC_PROFILE_BEGIN("upload");
 	glClear(GL_COLOR_BUFFER_BIT);
 	glUseProgram(renderer->shader);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer->double_pbo[renderer->current_pbo]);
 	glBindTexture(GL_TEXTURE_2D, renderer->tex);
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderer->num_columns, renderer->num_rows, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	if (renderer->is_column_major)
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderer->num_rows, renderer->num_columns, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, renderer->num_columns, renderer->num_rows, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glBindVertexArray(renderer->vao);
 	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
+	RC_PROFILE_END();
+
 	// Flip PBOs and draw to the new current PBO
 	renderer->current_pbo ^= 1;
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, renderer->double_pbo[renderer->current_pbo]);
 	glBufferData(GL_PIXEL_UNPACK_BUFFER, 4 * sizeof (unsigned char) * renderer->num_columns * renderer->num_rows, NULL, GL_STREAM_DRAW);
 	unsigned char *pixels = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	rc_renderer_internal_draw_frame(renderer, pixels, map, entities, camera, alpha);
+	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	RC_PROFILE_END();
+}
+
+// The last frame drawn by a headless renderer as RGBA rows from the bottom of the screen up
+const unsigned char *rc_renderer_get_pixels(const struct rc_renderer *renderer, int *width, int *height) {
+	RC_ASSERT(!renderer->window);
+	*width = renderer->num_columns;
+	*height = renderer->num_rows;
+	return renderer->headless_pixels;
+}
+
+void rc_renderer_destroy(struct rc_renderer *renderer) {
+	rc_log(RC_LOG_VERBOSE, "Destroying renderer...");
+	if (renderer->window) {
+		glDeleteVertexArrays(1, &renderer->vao);
+		glDeleteBuffers(1, &renderer->vbo);
+		glDeleteBuffers(1, &renderer->ibo);
+		glDeleteBuffers(2, renderer->double_pbo);
+		glDeleteTextures(1, &renderer->tex);
+		glDeleteProgram(renderer->shader);
+	}
+	free(renderer->headless_pixels);
+	free(renderer->column_major_pixels);
+	free(renderer->zbuffer);
+	free(renderer->row_colors);
+	free(renderer->row_lights);
+	free(renderer->visible_entities);
+	free(renderer->sprites);
+	free(renderer->tiles);
+	free(renderer);
+}
+
+// Split the screen into tiles, or a single tile covering the whole screen when not tiling
+static void rc_renderer_internal_resize_tiles(struct rc_renderer *renderer) {
+	const int tile_columns = (renderer->tile_columns) ? renderer->tile_columns : renderer->num_columns;
+	renderer->tiles_count = (renderer->num_columns + tile_columns - 1) / tile_columns;
+	struct rc_renderer_tile *new_tiles = realloc(renderer->tiles, sizeof *new_tiles * renderer->tiles_count);
+	RC_ASSERT(new_tiles);
+	renderer->tiles = new_tiles;
+	for (int i = 0; i < renderer->tiles_count; i++) {
+		renderer->tiles[i].first_column = i * tile_columns;
+		renderer->tiles[i].end_column = (i + 1 < renderer->tiles_count) ? (i + 1) * tile_columns : renderer->num_columns;
+		rc_renderer_internal_clear_lit_palettes(&renderer->tiles[i]);
+	}
+}
+
+// Frames are either row-major, or column-major with each column of the screen contiguous
+// Windowed renderers upload column-major frames as a transposed texture, which the vertex shader swaps back
+static void rc_renderer_internal_resize_frame(struct rc_renderer *renderer) {
+	renderer->row_stride = (renderer->is_column_major) ? 1 : renderer->num_columns;
+	renderer->column_stride = (renderer->is_column_major) ? renderer->num_rows : 1;
+	if (renderer->window) {
+		rc_renderer_internal_resize_opengl_buffers(renderer);
+		return;
+	}
+
+	// Headless renderers draw column-major frames separately, then transpose them into the headless frame
+	unsigned char *new_headless_pixels = realloc(renderer->headless_pixels, 4 * sizeof *new_headless_pixels * renderer->num_columns * renderer->num_rows);
+	RC_ASSERT(new_headless_pixels);
+	renderer->headless_pixels = new_headless_pixels;
+	if (renderer->is_column_major) {
+		unsigned char *new_column_major_pixels = realloc(renderer->column_major_pixels, 4 * sizeof *new_column_major_pixels * renderer->num_columns * renderer->num_rows);
+		RC_ASSERT(new_column_major_pixels);
+		renderer->column_major_pixels = new_column_major_pixels;
+	} else {
+		free(renderer->column_major_pixels);
+		renderer->column_major_pixels = NULL;
+	}
+}
+
+// Draw the view from the camera into a frame of RGBA pixels
+static void rc_renderer_internal_draw_frame(struct rc_renderer *renderer, unsigned char *pixels, const struct rc_map *map, const struct rc_entity_pool *entities, struct rc_entity_handle camera, double alpha) {
+	// Textures may have been requantized since the last frame
+	for (int i = 0; i < renderer->tiles_count; i++)
+		rc_renderer_internal_clear_lit_palettes(&renderer->tiles[i]);
 
 	// Prepare for drawing
+	struct rc_renderer_frame frame = { renderer, pixels, map };
+	rc_entity_get_interpolated_transform(entities, camera, alpha, &frame.cam_x, &frame.cam_y, &frame.cam_z, &frame.cam_r);
+
+	// Each tile only writes its own columns and its own tile entry, so tiles can be drawn on any thread in any order
+	// Counters only count the thread which initialized them, so passes are only counted when not tiling
+	if (renderer->tile_columns) {
+		RC_PROFILE_BEGIN("tiles");
+		if (renderer->passes & RC_RENDERER_PASS_SPRITES)
+			rc_renderer_internal_find_visible_entities(renderer, map, entities, alpha, frame.cam_x, frame.cam_y, frame.cam_z, frame.cam_r);
+		if (renderer->jobs)
+			rc_job_system_run(renderer->jobs, rc_renderer_internal_draw_tile, &frame, renderer->tiles_count);
+		else
+			for (int i = 0; i < renderer->tiles_count; i++)
+				rc_renderer_internal_draw_tile(&frame, i);
+		RC_PROFILE_END();
+		return;
+	}
+
+	// Draw floor and ceiling
+	struct rc_renderer_tile *screen = &renderer->tiles[0];
+	if (renderer->passes & RC_RENDERER_PASS_FLOOR_AND_CEILING) {
+		RC_PROFILE_BEGIN("floor and ceiling");
+		rc_counters_begin(RC_COUNTERS_FLOOR_AND_CEILING);
+		rc_renderer_internal_draw_floor_and_ceiling(renderer, screen, pixels, map, frame.cam_x, frame.cam_y, frame.cam_z, frame.cam_r);
+		rc_counters_end(RC_COUNTERS_FLOOR_AND_CEILING);
+		RC_PROFILE_END();
+	}
+
+	// Draw walls - sprites are never hidden when they are skipped
+	if (renderer->passes & RC_RENDERER_PASS_WALLS) {
+		RC_PROFILE_BEGIN("walls");
+		rc_counters_begin(RC_COUNTERS_WALLS);
+		rc_renderer_internal_draw_walls(renderer, screen, pixels, map, frame.cam_x, frame.cam_y, frame.cam_z, frame.cam_r);
+		rc_counters_end(RC_COUNTERS_WALLS);
+		RC_PROFILE_END();
+	} else {
+		for (int column = 0; column < renderer->num_columns; column++)
+			renderer->zbuffer[column] = INFINITY;
+	}
+
+	// Draw entities
+	if (renderer->passes & RC_RENDERER_PASS_SPRITES) {
+		RC_PROFILE_BEGIN("sprites");
+		rc_counters_begin(RC_COUNTERS_SPRITES);
+		rc_renderer_internal_find_visible_entities(renderer, map, entities, alpha, frame.cam_x, frame.cam_y, frame.cam_z, frame.cam_r);
+		rc_renderer_internal_draw_sprites(renderer, screen, pixels);
+		rc_counters_end(RC_COUNTERS_SPRITES);
+		RC_PROFILE_END();
+	}
+}
+
+// Draw every pass for the columns of one tile
+static void rc_renderer_internal_draw_tile(void *frame, int tile_index) {
+	const struct rc_renderer_frame *tile_frame = frame;
+	const struct rc_renderer *renderer = tile_frame->renderer;
+	struct rc_renderer_tile *tile = &renderer->tiles[tile_index];
+	RC_PROFILE_BEGIN("tile");
+	if (renderer->passes & RC_RENDERER_PASS_FLOOR_AND_CEILING)
+		rc_renderer_internal_draw_floor_and_ceiling(renderer, tile, tile_frame->pixels, tile_frame->map, tile_frame->cam_x, tile_frame->cam_y, tile_frame->cam_z, tile_frame->cam_r);
+	if (renderer->passes & RC_RENDERER_PASS_WALLS) {
+		rc_renderer_internal_draw_walls(renderer, tile, tile_frame->pixels, tile_frame->map, tile_frame->cam_x, tile_frame->cam_y, tile_frame->cam_z, tile_frame->cam_r);
+	} else {
+		for (int column = tile->first_column; column < tile->end_column; column++)
+			renderer->zbuffer[column] = INFINITY;
+	}
+	if (renderer->passes & RC_RENDERER_PASS_SPRITES)
+		rc_renderer_internal_draw_sprites(renderer, tile, tile_frame->pixels);
+	RC_PROFILE_END();
+}
+
+// Find the entities within the view of the camera - the margin covers entities drawn slightly behind where they are
+// Visible entities are then placed on-screen once here rather than once by every tile they might cross
+static void rc_renderer_internal_find_visible_entities(struct rc_renderer *renderer, const struct rc_map *map, const struct rc_entity_pool *entities, double alpha, double cam_x, double cam_y, double cam_z, double cam_r) {
+	int map_width, map_height;
+	rc_map_get_size(map, &map_width, &map_height);
+	const int entities_count = rc_entity_pool_get_count(entities);
+	if (entities_count > renderer->visible_entities_capacity) {
+		int *new_visible_entities = realloc(renderer->visible_entities, sizeof *new_visible_entities * entities_count);
+		struct rc_renderer_sprite *new_sprites = realloc(renderer->sprites, sizeof *new_sprites * entities_count);
+		RC_ASSERT(new_visible_entities && new_sprites);
+		renderer->visible_entities = new_visible_entities;
+		renderer->sprites = new_sprites;
+		renderer->visible_entities_capacity = entities_count;
+	}
+	const double view_range = sqrt(map_width * map_width + map_height * map_height);
+	const int visible_entities_count = rc_entity_pool_query_frustum(entities, cam_x, cam_y, cam_r, renderer->fov, view_range, 1.0, renderer->visible_entities, renderer->visible_entities_capacity);
+
+	// Visible entities are indices into the dense arrays of the pool, so they are read directly
+	const struct rc_texture *const *entities_textures = rc_entity_pool_get_textures(entities);
+	const double *entities_x, *entities_y, *entities_z, *entities_r;
+	const double *previous_x, *previous_y, *previous_z, *previous_r;
+	rc_entity_pool_get_transforms(entities, &entities_x, &entities_y, &entities_z, &entities_r);
+	rc_entity_pool_get_previous_transforms(entities, &previous_x, &previous_y, &previous_z, &previous_r);
+
+	renderer->sprites_count = 0;
+	for (int i = 0; i < visible_entities_count; i++) {
+		const int entity = renderer->visible_entities[i];
+		const struct rc_texture *tex = entities_textures[entity];
+
+		// Skip untextured entities
+		if (!tex)
+			continue;
+
+		// Get entity transformation, blended between the start and end of the last update
+		const double entity_x = previous_x[entity] + (entities_x[entity] - previous_x[entity]) * alpha;
+		const double entity_y = previous_y[entity] + (entities_y[entity] - previous_y[entity]) * alpha;
+		const double entity_z = previous_z[entity] + (entities_z[entity] - previous_z[entity]) * alpha;
+		const double entity_s = 1.0; // TODO: entity scaling
+
+		// Calculate entitys transformation relative to camera
+		const double entity_offset_x = entity_x - cam_x, entity_offset_y = entity_y - cam_y, entity_offset_z = entity_z - cam_z;
+		const double entity_transform_x = entity_offset_y * cos(cam_r) - entity_offset_x * sin(cam_r);
+		const double entity_transform_y = entity_offset_x * cos(cam_r) + entity_offset_y * sin(cam_r);
+
+		// Skip entities behind camera view
+		if (entity_transform_y < 0)
+			continue;
+
+		// Calculate the transformation of the entitys texture on-screen
+		const double texture_x_scaling = renderer->num_columns * (1 + entity_transform_x / entity_transform_y / renderer->fov);
+		const double texture_y_scaling = renderer->num_rows * entity_s / entity_transform_y / renderer->fov;
+		const double texture_z_scaling = renderer->num_rows * entity_offset_z / entity_transform_y / renderer->fov;
+
+		// Calculate common scaling calculations - these are generally used to figure out screen texture boundaries
+		const double x_lower_bound = (texture_x_scaling - texture_y_scaling) / 2;
+		const double x_upper_bound = (texture_x_scaling + texture_y_scaling) / 2;
+		const double y_lower_bound = (renderer->num_rows - texture_y_scaling) / 2;
+		const double y_upper_bound = (renderer->num_rows + texture_y_scaling) / 2;
+
+		// Calculate screen pixel coordinates of texture, skipping entities entirely off-screen
+		struct rc_renderer_sprite *sprite = &renderer->sprites[renderer->sprites_count];
+		sprite->first_column    = round(fmax(x_lower_bound, 0));
+		sprite->tex_base_column = round(fmax(-x_lower_bound, 0));
+		sprite->last_column     = round(fmin(x_upper_bound, renderer->num_columns));
+		sprite->first_row       = round(fmax(y_lower_bound + texture_z_scaling, 0));
+		sprite->tex_base_row    = round(fmax(-y_lower_bound - texture_z_scaling, 0));
+		sprite->last_row        = round(fmin(y_upper_bound + texture_z_scaling, renderer->num_rows));
+		if (sprite->first_column >= sprite->last_column)
+			continue;
+
+		// Calculate distances between each sample along the column or row, and the lighting of the entity
+		sprite->texture = tex;
+		sprite->depth = entity_transform_y;
+		rc_texture_get_dimensions(tex, &sprite->tex_width, &sprite->tex_height);
+		sprite->span_kernels = rc_kernels_get_spans(sprite->tex_width, sprite->tex_height);
+		sprite->texels_per_column = sprite->tex_width / (x_upper_bound - x_lower_bound);
+		sprite->texels_per_row = sprite->tex_height / (y_upper_bound - y_lower_bound);
+		sprite->light[3] = 0xff;
+		rc_map_get_lighting(map, entity_x, entity_y, &sprite->light[0], &sprite->light[1], &sprite->light[2]);
+		renderer->sprites_count++;
+	}
+
+	// Draw sprites back to front, so nearer sprites are drawn over the ones behind them
+	qsort(renderer->sprites, renderer->sprites_count, sizeof *renderer->sprites, rc_renderer_internal_compare_sprites);
+}
+
+// Order sprites by descending depth
+static int rc_renderer_internal_compare_sprites(const void *a, const void *b) {
+	const double depth_a = ((const struct rc_renderer_sprite *) a)->depth, depth_b = ((const struct rc_renderer_sprite *) b)->depth;
+	return (depth_a < depth_b) - (depth_a > depth_b);
+}
+
+static void rc_renderer_internal_draw_floor_and_ceiling(const struct rc_renderer *renderer, struct rc_renderer_tile *tile, unsigned char *pixels, const struct rc_map *map, double cam_x, double cam_y, double cam_z, double cam_r) {
+	const struct rc_kernels *kernels = rc_kernels_get();
 	int map_width, map_height;
-	double cam_x, cam_y, cam_z, cam_r;
 	rc_map_get_size(map, &map_width, &map_height);
-	rc_entity_get_transform(camera, &cam_x, &cam_y, &cam_z, &cam_r);
 
-	// Draw floor and ceiling
 	const double ray_rx = cos(cam_r) + sin(cam_r) * renderer->fov;
 	const double ray_ry = sin(cam_r) - cos(cam_r) * renderer->fov;
 	const double xtiles_per_column = 2 * renderer->fov * sin(-cam_r) / renderer->num_columns;
 	const double ytiles_per_column = 2 * renderer->fov * cos( cam_r) / renderer->num_columns;
+	const int texels_shift = renderer->wall_textures_size_shift, texels_per_tile = 1 << texels_shift;
 	for (int row = 0; row < renderer->num_rows; row++) {
 		const bool is_floor = row < renderer->num_rows / 2;
 
-		// Draw the column of pixels for this row by sampling the floor/ceiling
-		// textures for all the tiles crossed by this stepping ray
+		// Draw the row of pixels by sampling the floor/ceiling textures for all the tiles crossed by this stepping ray
+		// Samples are lit together once a run of them within the map ends
 		const double row_angle = renderer->num_rows - 2 * row;
 		const double row_dst = 2 * renderer->num_rows / renderer->fov * ((is_floor) ? cam_z / row_angle : (1 - cam_z) / (1 - row_angle));
 		const double ray_step_x = row_dst * xtiles_per_column, ray_step_y = row_dst * ytiles_per_column;
-		double ray_x = cam_x + row_dst * ray_rx, ray_y = cam_y + row_dst * ray_ry;
-		for (int column = 0; column < renderer->num_columns; column++) {
+		double ray_x = cam_x + row_dst * ray_rx + tile->first_column * ray_step_x, ray_y = cam_y + row_dst * ray_ry + tile->first_column * ray_step_y;
+		unsigned char *row_pixels = &pixels[4 * row * renderer->row_stride];
+		int run_first_column = tile->first_column;
+		for (int column = tile->first_column; column < tile->end_column; column++, ray_x += ray_step_x, ray_y += ray_step_y) {
 
 			// Find the current tile and the position within this tile of the ray
-			const int tile_x = ray_x, tile_y = ray_y;
-			const double tile_offset_x = ray_x - tile_x, tile_offset_y = ray_y - tile_y;
-			ray_x += ray_step_x; ray_y += ray_step_y;
+			// When wall textures share a power-of-two size, the texel is found along with the tile from one grid of texels across the map
+			int tile_x, tile_y, tex_x, tex_y;
+			double tile_offset_x = 0, tile_offset_y = 0;
+			if (texels_shift) {
+				const int texel_x = floor(ray_x * texels_per_tile), texel_y = floor(ray_y * texels_per_tile);
+				tile_x = texel_x >> texels_shift; tile_y = texel_y >> texels_shift;
+				tex_x = texel_x & (texels_per_tile - 1); tex_y = texel_y & (texels_per_tile - 1);
+			} else {
+				tile_x = floor(ray_x); tile_y = floor(ray_y);
+				tile_offset_x = ray_x - tile_x; tile_offset_y = ray_y - tile_y;
+			}
 
 			// Don't draw tiles outside the map
-			if (tile_x < 0 || tile_x >= map_width || tile_y < 0 || tile_y >= map_height)
+			if (tile_x < 0 || tile_x >= map_width || tile_y < 0 || tile_y >= map_height) {
+				kernels->light_span(&row_pixels[4 * run_first_column * renderer->column_stride], renderer->column_stride, &renderer->row_colors[4 * run_first_column], &renderer->row_lights[4 * run_first_column], column - run_first_column);
+				run_first_column = column + 1;
 				continue;
+			}
 
-			// Get the pixel color of the position of the ray
-			int tex_width, tex_height;
-			unsigned char light_r, light_g, light_b;
-			unsigned char color_r, color_g, color_b, color_a;
-			rc_map_get_lighting(map, tile_x + tile_offset_x, tile_y + tile_offset_y, &light_r, &light_g, &light_b);
+			// Get the pixel color and lighting of the position of the ray
+			unsigned char *light = &renderer->row_lights[4 * column];
+			rc_map_get_lighting(map, ray_x, ray_y, &light[0], &light[1], &light[2]);
+			light[3] = 0xff;
 			const int tex_index = (is_floor) ? rc_map_get_floor(map, tile_x, tile_y) : rc_map_get_ceiling(map, tile_x, tile_y);
 			const struct rc_texture *tex = renderer->wall_textures[tex_index];
-			rc_texture_get_dimensions(tex, &tex_width, &tex_height);
-			const int tex_x = tex_width * tile_offset_x, tex_y = tex_height * tile_offset_y;
-			rc_texture_get_pixel(tex, tex_x, tex_y, &color_r, &color_g, &color_b, &color_a);
-
-			// Draw pixel to the screen
-			const int pixels_index = 4 * (row * renderer->num_columns + column);
-			pixels[pixels_index + 0] = color_r * light_r / 0xffp0;
-			pixels[pixels_index + 1] = color_g * light_g / 0xffp0;
-			pixels[pixels_index + 2] = color_b * light_b / 0xffp0;
-			pixels[pixels_index + 3] = color_a;
+			int tex_width = texels_per_tile, tex_height = texels_per_tile;
+			if (!texels_shift) {
+				rc_texture_get_dimensions(tex, &tex_width, &tex_height);
+				tex_x = tex_width * tile_offset_x; tex_y = tex_height * tile_offset_y;
+			}
+			const unsigned char *tex_indices = (renderer->is_palettized) ? rc_texture_get_indices(tex) : NULL;
+			if (tex_indices) {
+				int colors_count;
+				memcpy(&renderer->row_colors[4 * column], &rc_texture_get_palette(tex, &colors_count)[4 * tex_indices[tex_y * tex_width + tex_x]], 4);
+			} else {
+				memcpy(&renderer->row_colors[4 * column], &rc_texture_get_pixels(tex)[4 * (tex_y * tex_width + tex_x)], 4);
+			}
 		}
+		kernels->light_span(&row_pixels[4 * run_first_column * renderer->column_stride], renderer->column_stride, &renderer->row_colors[4 * run_first_column], &renderer->row_lights[4 * run_first_column], tile->end_column - run_first_column);
 	}
+}
 
-	// Draw walls
-	for (int column = 0; column < renderer->num_columns; column++) {
+static void rc_renderer_internal_draw_walls(const struct rc_renderer *renderer, struct rc_renderer_tile *tile, unsigned char *pixels, const struct rc_map *map, double cam_x, double cam_y, double cam_z, double cam_r) {
+	for (int column = tile->first_column; column < tile->end_column; column++) {
 
 		// Find distance from nearest wall to camera plane
 		int hit_x, hit_y, hit_side;
@@ -157,7 +572,7 @@ void rc_renderer_draw(struct rc_renderer *renderer, const struct rc_map *map, st
 		const double ray_offset = (2.0 * column / renderer->num_columns - 1) * renderer->fov;
 		const double ray_rx = cos(cam_r) - sin(cam_r) * ray_offset;
 		const double ray_ry = sin(cam_r) + cos(cam_r) * ray_offset;
-		rc_renderer_internal_raycast(map, cam_x, cam_y, atan2(ray_ry, ray_rx), &hit_x, &hit_y, &hit_side, &hit_dst, &hit_lat);
+		rc_map_raycast(map, cam_x, cam_y, atan2(ray_ry, ray_rx), &hit_x, &hit_y, &hit_side, &hit_dst, &hit_lat);
 		hit_dst *= 1 / sqrt(ray_rx * ray_rx + ray_ry * ray_ry);
 		renderer->zbuffer[column] = hit_dst;
 
@@ -190,156 +605,89 @@ void rc_renderer_draw(struct rc_renderer *renderer, const struct rc_map *map, st
 		if (hit_side) (ray_rx < 0) ? hit_x++ : hit_x--;
 		else          (ray_ry < 0) ? hit_y++ : hit_y--;
 
-		// Draw a vertical line for the wall column
-		for (int row = first_row; row < last_row; row++) {
-
-			// Sample texture
-			unsigned char light_r, light_g, light_b;
-			unsigned char color_r, color_g, color_b, color_a;
-			rc_map_get_lighting(map, hit_x, hit_y, &light_r, &light_g, &light_b);
-			rc_texture_get_pixel(tex, tex_x, tex_y, &color_r, &color_g, &color_b, &color_a);
-			tex_y -= texels_per_row;
-
-			// Fill in the pixel in the PBO
-			const int pixels_index = 4 * (row * renderer->num_columns + column);
-			pixels[pixels_index + 0] = color_r * light_r / 0xffp0;
-			pixels[pixels_index + 1] = color_g * light_g / 0xffp0;
-			pixels[pixels_index + 2] = color_b * light_b / 0xffp0;
-			pixels[pixels_index + 3] = color_a;
+		// The whole column has the same lighting, so quantized textures can be drawn straight from a lit palette
+		unsigned char light[4] = { [3] = 0xff };
+		rc_map_get_lighting(map, hit_x, hit_y, &light[0], &light[1], &light[2]);
+		unsigned char *column_pixels = &pixels[4 * (first_row * renderer->row_stride + column * renderer->column_stride)];
+		const struct rc_kernels_spans *span_kernels = rc_kernels_get_spans(tex_width, tex_height);
+		const unsigned char *tex_indices = (renderer->is_palettized) ? rc_texture_get_indices(tex) : NULL;
+		if (tex_indices) {
+			const unsigned char *lit_palette = rc_renderer_internal_get_lit_palette(tile, tex, light);
+			span_kernels->draw_palettized_wall_span(column_pixels, renderer->row_stride, &tex_indices[(int) tex_x], tex_width, tex_y, texels_per_row, lit_palette, last_row - first_row);
+		} else {
+			span_kernels->draw_wall_span(column_pixels, renderer->row_stride, &rc_texture_get_pixels(tex)[4 * (int) tex_x], tex_width, tex_y, texels_per_row, light, last_row - first_row);
 		}
 	}
+}
 
-	// Draw entities
-	// TODO: sort entities here
-	for (int i = 0; i < entities_count; i++) {
-		const struct rc_texture *tex = rc_entity_get_texture(entities[i]);
-
-		// Skip untextured entities
-		if (!tex)
-			continue;
-
-		// Get entity transformation and lighting
-		double entity_x, entity_y, entity_z, entity_r, entity_s = 1.0; // TODO: entity scaling
-		unsigned char light_r, light_g, light_b;
-		rc_entity_get_transform(entities[i], &entity_x, &entity_y, &entity_z, &entity_r);
-		rc_map_get_lighting(map, entity_x, entity_y, &light_r, &light_g, &light_b);
-
-		// Calculate entitys transformation relative to camera
-		const double entity_offset_x = entity_x - cam_x, entity_offset_y = entity_y - cam_y, entity_offset_z = entity_z - cam_z;
-		const double entity_transform_x = entity_offset_y * cos(cam_r) - entity_offset_x * sin(cam_r);
-		const double entity_transform_y = entity_offset_x * cos(cam_r) + entity_offset_y * sin(cam_r);
-
-		// Skip entities behind camera view
-		if (entity_transform_y < 0)
+static void rc_renderer_internal_draw_sprites(const struct rc_renderer *renderer, struct rc_renderer_tile *tile, unsigned char *pixels) {
+	for (int i = 0; i < renderer->sprites_count; i++) {
+		const struct rc_renderer_sprite *sprite = &renderer->sprites[i];
+		const struct rc_texture *tex = sprite->texture;
+		const int first_row = sprite->first_row, last_row = sprite->last_row;
+		const int tex_width = sprite->tex_width, tex_height = sprite->tex_height;
+		const double texels_per_row = sprite->texels_per_row;
+
+		// Skip entities outside the tile
+		const int tile_first_column = (sprite->first_column > tile->first_column) ? sprite->first_column : tile->first_column;
+		const int tile_last_column = (sprite->last_column < tile->end_column) ? sprite->last_column : tile->end_column;
+		if (tile_first_column >= tile_last_column)
 			continue;
 
-		// Calculate the transformation of the entitys texture on-screen
-		const double texture_x_scaling = renderer->num_columns * (1 + entity_transform_x / entity_transform_y / renderer->fov);
-		const double texture_y_scaling = renderer->num_rows * entity_s / entity_transform_y / renderer->fov;
-		const double texture_z_scaling = renderer->num_rows * entity_offset_z / entity_transform_y / renderer->fov;
-
-		// Calculate common scaling calculations - these are generally used to figure out screen texture boundaries
-		const double x_lower_bound = (texture_x_scaling - texture_y_scaling) / 2;
-		const double x_upper_bound = (texture_x_scaling + texture_y_scaling) / 2;
-		const double y_lower_bound = (renderer->num_rows - texture_y_scaling) / 2;
-		const double y_upper_bound = (renderer->num_rows + texture_y_scaling) / 2;
-
-		// Calculate screen pixel coordinates of texture
-		// first to last is the range of the texture on-screen
-		// tex_base accounts for the texture beginning off-screen
-		const int first_column    = round(fmax(x_lower_bound, 0));
-		const int tex_base_column = round(fmax(-x_lower_bound, 0));
-		const int last_column     = round(fmin(x_upper_bound, renderer->num_columns));
-		const int first_row       = round(fmax(y_lower_bound + texture_z_scaling, 0));
-		const int tex_base_row    = round(fmax(-y_lower_bound - texture_z_scaling, 0));
-		const int last_row        = round(fmin(y_upper_bound + texture_z_scaling, renderer->num_rows));
-
-		// Calculate distances between each sample along the column or row
-		int tex_width, tex_height;
-		rc_texture_get_dimensions(tex, &tex_width, &tex_height);
-		const double texels_per_column = tex_width / (x_upper_bound - x_lower_bound);
-		const double texels_per_row = tex_height / (y_upper_bound - y_lower_bound);
+		const unsigned char *tex_indices = (renderer->is_palettized) ? rc_texture_get_indices(tex) : NULL;
+		const unsigned char *tex_pixels = rc_texture_get_pixels(tex);
+		const unsigned char *lit_palette = (tex_indices) ? rc_renderer_internal_get_lit_palette(tile, tex, sprite->light) : NULL;
 
-		// Iterate over every column on the screen that contains the texture being drawn
-		for (int column = first_column; column < last_column; column++) {
+		// Iterate over every column of the tile that contains the texture being drawn
+		for (int column = tile_first_column; column < tile_last_column; column++) {
 
 			// Skip the column if the texture is hidden behind a wall
-			if (entity_transform_y > renderer->zbuffer[column])
+			if (sprite->depth > renderer->zbuffer[column])
 				continue;
 
-			// Iterate over every row on the screen that contains the texture being drawn
-			for (int row = first_row; row < last_row; row++) {
-
-				// Calculate texture sample point
-				const int tex_x = (column - first_column + tex_base_column) * texels_per_column;
-				const int tex_y = tex_height - (row - first_row + tex_base_row) * texels_per_row - 1;
-
-				// Sample texture
-				// TODO: used RBGA instead of RBG textures, currently black is a transparent pixel
-				unsigned char color_r, color_g, color_b, color_a;
-				rc_texture_get_pixel(tex, tex_x, tex_y, &color_r, &color_g, &color_b, &color_a);
-				if (!color_r && !color_g && !color_b)
-					continue;
-
-				// Fill in the pixel in the PBO
-				const int pixels_index = 4 * (row * renderer->num_columns + column);
-				pixels[pixels_index + 0] = color_r * light_r / 0xffp0;
-				pixels[pixels_index + 1] = color_g * light_g / 0xffp0;
-				pixels[pixels_index + 2] = color_b * light_b / 0xffp0;
-				pixels[pixels_index + 3] = color_a;
+			// Only the opaque spans of the texture column are drawn
+			int spans_count;
+			const int tex_x = fmin((column - sprite->first_column + sprite->tex_base_column) * sprite->texels_per_column, tex_width - 1);
+			const struct rc_texture_span *spans = rc_texture_get_column_spans(tex, tex_x, &spans_count);
+			for (int span = 0; span < spans_count; span++) {
+
+				// Texture rows run upwards on-screen, so start from the row the end of the span should land just above
+				// Rounding can put this a row off, so start a row early and skip rows below the span
+				const int span_first_row = floor((tex_height - 1 - spans[span].end) / texels_per_row) - 1 + first_row - sprite->tex_base_row;
+				const int row = (span_first_row > first_row) ? span_first_row : first_row;
+				unsigned char *column_pixels = &pixels[4 * (row * renderer->row_stride + column * renderer->column_stride)];
+				const int tex_row = row - first_row + sprite->tex_base_row;
+				if (tex_indices)
+					sprite->span_kernels->draw_palettized_sprite_span(column_pixels, renderer->row_stride, &tex_indices[tex_x], tex_width, tex_height, tex_row, texels_per_row, spans[span].first, spans[span].end, lit_palette, last_row - row);
+				else
+					sprite->span_kernels->draw_sprite_span(column_pixels, renderer->row_stride, &tex_pixels[4 * tex_x], tex_width, tex_height, tex_row, texels_per_row, spans[span].first, spans[span].end, sprite->light, last_row - row);
 			}
 		}
 	}
-
-	glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-}
-
-void rc_renderer_destroy(struct rc_renderer *renderer) {
-	rc_log(RC_LOG_VERBOSE, "Destroying renderer...");
-	glDeleteVertexArrays(1, &renderer->vao);
-	glDeleteBuffers(1, &renderer->vbo);
-	glDeleteBuffers(1, &renderer->ibo);
-	glDeleteBuffers(2, renderer->double_pbo);
-	glDeleteTextures(1, &renderer->tex);
-	glDeleteProgram(renderer->shader);
-	free(renderer->zbuffer);
 }
 
-static void rc_renderer_internal_raycast(const struct rc_map *map, double x, double y, double a, int *hit_x, int *hit_y, int *hit_side, double *hit_dst, double *hit_lat) {
-
-	// Starting point
-	*hit_x = x, *hit_y = y;
-	double distance_x = x - *hit_x, distance_y = y - *hit_y;
-
-	// Direction vector
-	const double angle_x = cos(a), angle_y = sin(a);
-	const double delta_x = fabs(1 / angle_x), delta_y = fabs(1 / angle_y);
-
-	// Flip step vector for negative directions
-	int step_x = -1, step_y = -1;
-	if (angle_x >= 0) { distance_x = 1 - distance_x; step_x = 1; }
-	if (angle_y >= 0) { distance_y = 1 - distance_y; step_y = 1; }
-	distance_x *= delta_x; distance_y *= delta_y;
-
-	// Euclidean distance to the nearest wall
-	*hit_side = 0;
-	while (rc_map_get_wall(map, *hit_x, *hit_y) == -1) {
-		if (distance_x < distance_y) {
-			*hit_side = 1;
-			*hit_x += step_x;
-			distance_x += delta_x;
-		} else {
-			*hit_side = 0;
-			*hit_y += step_y;
-			distance_y += delta_y;
-		}
+// Light is RGBA with full alpha, so palette alpha is kept
+static const unsigned char *rc_renderer_internal_get_lit_palette(struct rc_renderer_tile *tile, const struct rc_texture *texture, const unsigned char *light) {
+	for (int i = 0; i < RC_RENDERER_LIT_PALETTES_COUNT; i++) {
+		const struct rc_renderer_lit_palette *lit_palette = &tile->lit_palettes[i];
+		if (texture == lit_palette->texture && !memcmp(light, lit_palette->light, 4))
+			return lit_palette->colors;
 	}
 
-	// Calculate distance and point on the wall surface
-	*hit_dst = (*hit_side) ? distance_x - delta_x : distance_y - delta_y;
-	*hit_lat = (*hit_side) ? y + angle_y * *hit_dst : x + angle_x * *hit_dst;
-	*hit_lat -= (int)*hit_lat;
+	int colors_count;
+	const unsigned char *palette = rc_texture_get_palette(texture, &colors_count);
+	struct rc_renderer_lit_palette *lit_palette = &tile->lit_palettes[tile->next_lit_palette];
+	tile->next_lit_palette = (tile->next_lit_palette + 1) % RC_RENDERER_LIT_PALETTES_COUNT;
+	rc_kernels_get()->light_palette(lit_palette->colors, palette, light, colors_count);
+	lit_palette->texture = texture;
+	memcpy(lit_palette->light, light, 4);
+	return lit_palette->colors;
+}
+
+static void rc_renderer_internal_clear_lit_palettes(struct rc_renderer_tile *tile) {
+	tile->next_lit_palette = 0;
+	for (int i = 0; i < RC_RENDERER_LIT_PALETTES_COUNT; i++)
+		tile->lit_palettes[i].texture = NULL;
 }
 
 static void rc_renderer_internal_initialize_opengl(struct rc_renderer *renderer) {
@@ -421,17 +769,19 @@ static void rc_renderer_internal_resize_opengl_buffers(struct rc_renderer *rende
 	free(blank_frame);
 
 	// Allocate the texture object buffer - Also transfer the new PBO into it
+	// Column-major frames are the transpose of the screen, so the texture is too
 	glBindTexture(GL_TEXTURE_2D, renderer->tex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, renderer->num_columns, renderer->num_rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL); // TODO: watch out for max texture size
+	if (renderer->is_column_major)
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, renderer->num_rows, renderer->num_columns, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL); // TODO: watch out for max texture size
+	else
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, renderer->num_columns, renderer->num_rows, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL); // TODO: watch out for max texture size
+	glUseProgram(renderer->shader);
+	glUniform1i(glGetUniformLocation(renderer->shader, "is_transposed"), renderer->is_column_major);
+	glUseProgram(0);
 
 	// Done - Unbind buffers
 	glBindTexture(GL_TEXTURE_2D, 0);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
-
-	// Resize the zbuffer
-	double *new_zbuffer  = realloc(renderer->zbuffer, sizeof *new_zbuffer * renderer->num_columns);
-	RC_ASSERT(new_zbuffer);
-	renderer->zbuffer = new_zbuffer;
 }
 
 static unsigned rc_renderer_internal_create_shader(const char *filepath, GLenum shader_type) {
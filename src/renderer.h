@@ -1,18 +1,34 @@
 #ifndef RC_RENDERER_H
 #define RC_RENDERER_H
 
+#include "entity.h"
+#include <stdbool.h>
+
 struct rc_renderer;
 struct rc_window;
 struct rc_map;
-struct rc_entity;
 struct rc_texture;
+struct rc_job_system;
+
+enum rc_renderer_pass {
+	RC_RENDERER_PASS_FLOOR_AND_CEILING = 1 << 0,
+	RC_RENDERER_PASS_WALLS = 1 << 1,
+	RC_RENDERER_PASS_SPRITES = 1 << 2,
+	RC_RENDERER_PASS_ALL = (1 << 3) - 1
+};
 
-struct rc_renderer *rc_renderer_create(const struct rc_window *window, double aspect, int resolution, double fov, struct rc_texture **wall_textures);
+struct rc_renderer *rc_renderer_create(const struct rc_window *window, double aspect, int resolution, double fov, struct rc_texture **wall_textures, int wall_textures_count);
+struct rc_renderer *rc_renderer_create_headless(double aspect, int resolution, double fov, struct rc_texture **wall_textures, int wall_textures_count);
 void rc_renderer_set_dimensions(const struct rc_renderer *renderer, int width, int height);
 void rc_renderer_set_fov(struct rc_renderer *renderer, double fov);
 void rc_renderer_set_resolution(struct rc_renderer *renderer, int resolution);
-void rc_renderer_set_wall_textures(struct rc_renderer *renderer, struct rc_texture **wall_textures);
-void rc_renderer_draw(struct rc_renderer *renderer, const struct rc_map *map, struct rc_entity **entities, int entities_count, const struct rc_entity *camera);
+void rc_renderer_set_wall_textures(struct rc_renderer *renderer, struct rc_texture **wall_textures, int wall_textures_count);
+void rc_renderer_set_palettized(struct rc_renderer *renderer, bool is_palettized);
+void rc_renderer_set_passes(struct rc_renderer *renderer, int passes);
+void rc_renderer_set_column_major(struct rc_renderer *renderer, bool is_column_major);
+void rc_renderer_set_tiles(struct rc_renderer *renderer, int tile_columns, struct rc_job_system *jobs);
+void rc_renderer_draw(struct rc_renderer *renderer, const struct rc_map *map, const struct rc_entity_pool *entities, struct rc_entity_handle camera, double alpha);
+const unsigned char *rc_renderer_get_pixels(const struct rc_renderer *renderer, int *width, int *height);
 void rc_renderer_destroy(struct rc_renderer *renderer);
 
 #endif
@@ -0,0 +1,127 @@
+#include "stats.h"
+#include "logging.h"
+#include "error.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Durations are counted in fixed width histogram buckets, so recording is constant time and memory
+// Anything longer than the last bucket is counted in it, but the exact maximum is always kept
+#define RC_STATS_BUCKET_WIDTH 0.0001
+#define RC_STATS_BUCKETS_COUNT 1000
+
+struct rc_stats_histogram {
+	unsigned buckets[RC_STATS_BUCKETS_COUNT];
+	unsigned count;
+	double max;
+};
+
+// The window histograms are reset after every report, the total histograms cover the whole run
+struct rc_frame_stats {
+	double report_interval, time_since_report;
+	struct rc_stats_histogram window_frames, window_ticks, total_frames, total_ticks;
+	unsigned window_dropped_ticks, window_catch_ups, total_dropped_ticks, total_catch_ups;
+};
+
+static void rc_stats_internal_add(struct rc_stats_histogram *histogram, double duration);
+static double rc_stats_internal_get_percentile(const struct rc_stats_histogram *histogram, double percentile);
+static void rc_stats_internal_report(const char *label, const struct rc_stats_histogram *frames, const struct rc_stats_histogram *ticks, unsigned dropped_ticks, unsigned catch_ups);
+
+// Statistics are reported through the log every report_interval seconds of recorded frames
+struct rc_frame_stats *rc_frame_stats_create(double report_interval) {
+	rc_log(RC_LOG_VERBOSE, "Creating new frame statistics...");
+	struct rc_frame_stats *stats = calloc(1, sizeof *stats);
+	RC_ASSERT(stats);
+	stats->report_interval = report_interval;
+	return stats;
+}
+
+void rc_frame_stats_record_tick(struct rc_frame_stats *stats, double duration) {
+	rc_stats_internal_add(&stats->window_ticks, duration);
+	rc_stats_internal_add(&stats->total_ticks, duration);
+}
+
+// Frames which ran more than one tick were catching up, and dropped ticks are those skipped to stop catching up
+void rc_frame_stats_record_frame(struct rc_frame_stats *stats, double duration, int ticks_count, int dropped_ticks_count) {
+	rc_stats_internal_add(&stats->window_frames, duration);
+	rc_stats_internal_add(&stats->total_frames, duration);
+	if (ticks_count > 1) {
+		stats->window_catch_ups++;
+		stats->total_catch_ups++;
+	}
+	stats->window_dropped_ticks += dropped_ticks_count;
+	stats->total_dropped_ticks += dropped_ticks_count;
+
+	stats->time_since_report += duration;
+	if (stats->report_interval > 0 && stats->time_since_report >= stats->report_interval) {
+		rc_stats_internal_report("Last", &stats->window_frames, &stats->window_ticks, stats->window_dropped_ticks, stats->window_catch_ups);
+		memset(&stats->window_frames, 0, sizeof stats->window_frames);
+		memset(&stats->window_ticks, 0, sizeof stats->window_ticks);
+		stats->window_dropped_ticks = stats->window_catch_ups = 0;
+		stats->time_since_report = 0;
+	}
+}
+
+// Write the histograms of the whole run, one row per bucket
+bool rc_frame_stats_write_csv(const struct rc_frame_stats *stats, const char *filename) {
+	rc_log(RC_LOG_INFO, "Writing frame statistics to '%s'...", filename);
+	FILE *file = fopen(filename, "w");
+	if (!file) {
+		rc_log(RC_LOG_WARN, "Unable to open '%s' for writing", filename);
+		return false;
+	}
+	fputs("bucket_start_ms,bucket_end_ms,frames,ticks\n", file);
+	for (int i = 0; i < RC_STATS_BUCKETS_COUNT; i++) {
+		if (!stats->total_frames.buckets[i] && !stats->total_ticks.buckets[i])
+			continue;
+		const double max = (stats->total_frames.max > stats->total_ticks.max) ? stats->total_frames.max : stats->total_ticks.max;
+		const double bucket_end = (i == RC_STATS_BUCKETS_COUNT - 1) ? max : (i + 1) * RC_STATS_BUCKET_WIDTH;
+		fprintf(file, "%.1f,%.1f,%u,%u\n", i * RC_STATS_BUCKET_WIDTH * 1000, bucket_end * 1000, stats->total_frames.buckets[i], stats->total_ticks.buckets[i]);
+	}
+	if (fclose(file)) {
+		rc_log(RC_LOG_WARN, "Unable to write '%s'", filename);
+		return false;
+	}
+	return true;
+}
+
+void rc_frame_stats_destroy(struct rc_frame_stats *stats) {
+	rc_log(RC_LOG_VERBOSE, "Destroying frame statistics...");
+	rc_stats_internal_report("Overall", &stats->total_frames, &stats->total_ticks, stats->total_dropped_ticks, stats->total_catch_ups);
+	free(stats);
+}
+
+static void rc_stats_internal_add(struct rc_stats_histogram *histogram, double duration) {
+	const int bucket = duration / RC_STATS_BUCKET_WIDTH;
+	histogram->buckets[(bucket < RC_STATS_BUCKETS_COUNT) ? ((bucket > 0) ? bucket : 0) : RC_STATS_BUCKETS_COUNT - 1]++;
+	histogram->count++;
+	if (duration > histogram->max)
+		histogram->max = duration;
+}
+
+// Upper bound of the bucket holding the percentile, which is never more than the maximum
+static double rc_stats_internal_get_percentile(const struct rc_stats_histogram *histogram, double percentile) {
+	const unsigned target = histogram->count * percentile;
+	unsigned count = 0;
+	for (int i = 0; i < RC_STATS_BUCKETS_COUNT - 1; i++) {
+		count += histogram->buckets[i];
+		if (count > target)
+			return ((i + 1) * RC_STATS_BUCKET_WIDTH < histogram->max) ? (i + 1) * RC_STATS_BUCKET_WIDTH : histogram->max;
+	}
+	return histogram->max;
+}
+
+static void rc_stats_internal_report(const char *label, const struct rc_stats_histogram *frames, const struct rc_stats_histogram *ticks, unsigned dropped_ticks, unsigned catch_ups) {
+	if (!frames->count)
+		return;
+	rc_log(RC_LOG_INFO, "%s %u frames (ms): p50 %.2f, p95 %.2f, p99 %.2f, max %.2f, %u catch-ups, %u dropped ticks",
+		label, frames->count,
+		rc_stats_internal_get_percentile(frames, 0.50) * 1000, rc_stats_internal_get_percentile(frames, 0.95) * 1000,
+		rc_stats_internal_get_percentile(frames, 0.99) * 1000, frames->max * 1000, catch_ups, dropped_ticks);
+	if (ticks->count)
+		rc_log(RC_LOG_INFO, "%s %u ticks (ms): p50 %.2f, p95 %.2f, p99 %.2f, max %.2f",
+			label, ticks->count,
+			rc_stats_internal_get_percentile(ticks, 0.50) * 1000, rc_stats_internal_get_percentile(ticks, 0.95) * 1000,
+			rc_stats_internal_get_percentile(ticks, 0.99) * 1000, ticks->max * 1000);
+}
@@ -0,0 +1,14 @@
+#ifndef RC_STATS_H
+#define RC_STATS_H
+
+#include <stdbool.h>
+
+struct rc_frame_stats;
+
+struct rc_frame_stats *rc_frame_stats_create(double report_interval);
+void rc_frame_stats_record_tick(struct rc_frame_stats *stats, double duration);
+void rc_frame_stats_record_frame(struct rc_frame_stats *stats, double duration, int ticks_count, int dropped_ticks_count);
+bool rc_frame_stats_write_csv(const struct rc_frame_stats *stats, const char *filename);
+void rc_frame_stats_destroy(struct rc_frame_stats *stats);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef RC_TEXPACK_H
+#define RC_TEXPACK_H
+
+#include <stdint.h>
+
+// Texture packs hold textures already decoded to RGBA, so they can be used straight from a memory mapping of the file
+// The header is followed by a directory of entries, and every entrys texels start on an aligned offset into the file
+// Texels are stored in the same layout as decoded textures
+// Version 2 packs give black texels from images without an alpha channel an alpha of 0, which sprite spans rely on
+
+#define RC_TEXPACK_MAGIC "RCTP"
+#define RC_TEXPACK_VERSION 2
+#define RC_TEXPACK_ALIGNMENT 64
+#define RC_TEXPACK_MAX_FILENAME 112
+
+struct rc_texpack_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t entries_count;
+	uint32_t reserved;
+};
+
+struct rc_texpack_entry {
+	char filename[RC_TEXPACK_MAX_FILENAME];
+	uint32_t width, height;
+	uint64_t offset;
+};
+
+#endif
@@ -1,26 +1,223 @@
 #include "texture.h"
+#include "texpack.h"
 #include "logging.h"
 #include "error.h"
+#include "platform.h"
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb/stb_image.h>
 
+#ifdef RC_LINUX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 // TODO: replace stb_image
 
 struct rc_texture {
 	unsigned char *data;
 	int width, height;
+	bool is_packed;
+
+	// Quantized textures also hold a palette index for every texel
+	unsigned char *indices;
+	unsigned char palette[256][4];
+	int colors_count;
+
+	// Runs of opaque texels down each column - the spans of column x are [column_spans[x], column_spans[x + 1])
+	int *column_spans;
+	struct rc_texture_span *spans;
+};
+
+// A box of texels in colour space - quantizing repeatedly splits the widest box in two
+struct rc_texture_box {
+	int first, count;
+	unsigned char min[4], max[4];
 };
 
+// While a texture pack is mounted, textures found in it are used straight from its mapping instead of being decoded
+static const unsigned char *pack_data;
+static size_t pack_size;
+
+static const struct rc_texpack_entry *rc_texture_internal_find_packed(const char *filename);
+static void rc_texture_internal_find_spans(struct rc_texture *texture);
+static void rc_texture_internal_measure_box(const struct rc_texture *texture, const int *texels, struct rc_texture_box *box);
+static int rc_texture_internal_split_box(const struct rc_texture *texture, int *texels, const struct rc_texture_box *box, int channel);
+
 struct rc_texture *rc_texture_load(const char *filename) {
 	rc_log(RC_LOG_VERBOSE, "Loading texture '%s'...", filename);
 	struct rc_texture *texture = malloc(sizeof *texture);
 	RC_ASSERT(texture);
-	texture->data = stbi_load(filename, &texture->width, &texture->height, NULL, 4);
-	RC_ASSERT(texture->data);
+
+	const struct rc_texpack_entry *entry = rc_texture_internal_find_packed(filename);
+	if (entry) {
+		texture->data = (unsigned char *) pack_data + entry->offset;
+		texture->width = entry->width;
+		texture->height = entry->height;
+		texture->is_packed = true;
+		texture->indices = NULL;
+		rc_texture_internal_find_spans(texture);
+		return texture;
+	}
+
+	int channels_count;
+	texture->data = stbi_load(filename, &texture->width, &texture->height, &channels_count, 4);
+	if (!texture->data)
+		rc_error("Could not load texture '%s': %s", filename, stbi_failure_reason());
+	texture->is_packed = false;
+	texture->indices = NULL;
+
+	// Images without an alpha channel use black as transparent
+	if (channels_count == 1 || channels_count == 3)
+		for (int i = 0; i < texture->width * texture->height; i++)
+			if (!texture->data[4 * i + 0] && !texture->data[4 * i + 1] && !texture->data[4 * i + 2])
+				texture->data[4 * i + 3] = 0;
+
+	rc_texture_internal_find_spans(texture);
 	return texture;
 }
 
+// Build a palette of at most colors_count colours for the texture with median cut, and index every texel into it
+// The full colour texels are kept, so the texture can still be sampled either way
+void rc_texture_quantize(struct rc_texture *texture, int colors_count) {
+	rc_log(RC_LOG_VERBOSE, "Quantizing texture to %i colors...", colors_count);
+	RC_ASSERT(colors_count >= 1 && colors_count <= 256);
+	const int texels_count = texture->width * texture->height;
+	int *texels = malloc(sizeof *texels * texels_count);
+	RC_ASSERT(texels);
+	for (int i = 0; i < texels_count; i++)
+		texels[i] = i;
+
+	// Keep splitting the box with the widest channel at its median until there are enough colours
+	struct rc_texture_box boxes[256] = { { 0, texels_count } };
+	int boxes_count = 1;
+	rc_texture_internal_measure_box(texture, texels, &boxes[0]);
+	while (boxes_count < colors_count) {
+		int widest_box = -1, widest_channel = 0, widest_range = 0;
+		for (int i = 0; i < boxes_count; i++) {
+			for (int channel = 0; channel < 4; channel++) {
+				if (boxes[i].max[channel] - boxes[i].min[channel] > widest_range) {
+					widest_range = boxes[i].max[channel] - boxes[i].min[channel];
+					widest_box = i;
+					widest_channel = channel;
+				}
+			}
+		}
+		if (widest_box == -1)
+			break;
+		struct rc_texture_box *box = &boxes[widest_box], *new_box = &boxes[boxes_count++];
+		const int split = rc_texture_internal_split_box(texture, texels, box, widest_channel);
+		*new_box = (struct rc_texture_box) { box->first + split, box->count - split };
+		box->count = split;
+		rc_texture_internal_measure_box(texture, texels, box);
+		rc_texture_internal_measure_box(texture, texels, new_box);
+	}
+
+	// Every texel in a box is represented by the average colour of the box
+	free(texture->indices);
+	texture->indices = malloc(texels_count);
+	RC_ASSERT(texture->indices);
+	for (int i = 0; i < boxes_count; i++) {
+		unsigned sum[4] = { 0 };
+		for (int j = boxes[i].first; j < boxes[i].first + boxes[i].count; j++) {
+			for (int channel = 0; channel < 4; channel++)
+				sum[channel] += texture->data[4 * texels[j] + channel];
+			texture->indices[texels[j]] = i;
+		}
+		for (int channel = 0; channel < 4; channel++)
+			texture->palette[i][channel] = (sum[channel] + boxes[i].count / 2) / boxes[i].count;
+	}
+	texture->colors_count = boxes_count;
+	free(texels);
+}
+
+// Returns NULL if the texture hasn't been quantized
+const unsigned char *rc_texture_get_indices(const struct rc_texture *texture) {
+	return texture->indices;
+}
+
+// Texels are RGBA rows from the top down
+const unsigned char *rc_texture_get_pixels(const struct rc_texture *texture) {
+	return texture->data;
+}
+
+// Opaque spans of a column from top to bottom - transparent texels are never within a span
+const struct rc_texture_span *rc_texture_get_column_spans(const struct rc_texture *texture, int x, int *spans_count) {
+	*spans_count = texture->column_spans[x + 1] - texture->column_spans[x];
+	return &texture->spans[texture->column_spans[x]];
+}
+
+// Palette colours are RGBA
+const unsigned char *rc_texture_get_palette(const struct rc_texture *texture, int *colors_count) {
+	*colors_count = texture->colors_count;
+	return &texture->palette[0][0];
+}
+
+// Map a texture pack into memory - returns false and keeps decoding images if the pack can't be used
+// Textures loaded from the pack must be unloaded before it is unmounted
+bool rc_texture_mount_pack(const char *filename) {
+	rc_log(RC_LOG_INFO, "Mounting texture pack '%s'...", filename);
+	RC_ASSERT(!pack_data);
+#ifdef RC_LINUX
+	const int fd = open(filename, O_RDONLY);
+	if (fd == -1) {
+		rc_log(RC_LOG_WARN, "Unable to open texture pack '%s', textures will be decoded instead", filename);
+		return false;
+	}
+	struct stat file_stat;
+	void *mapping = MAP_FAILED;
+	if (fstat(fd, &file_stat) == 0 && (size_t) file_stat.st_size >= sizeof (struct rc_texpack_header))
+		mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		rc_log(RC_LOG_WARN, "Unable to map texture pack '%s', textures will be decoded instead", filename);
+		return false;
+	}
+
+	// Make sure the directory and every entry lie within the file before trusting it
+	const struct rc_texpack_header *header = mapping;
+	const size_t size = file_stat.st_size;
+	if (memcmp(header->magic, RC_TEXPACK_MAGIC, sizeof header->magic) == 0 && header->version != RC_TEXPACK_VERSION) {
+		rc_log(RC_LOG_WARN, "Texture pack '%s' is version %u rather than %u, textures will be decoded instead", filename, header->version, RC_TEXPACK_VERSION);
+		munmap(mapping, size);
+		return false;
+	}
+	bool is_valid = memcmp(header->magic, RC_TEXPACK_MAGIC, sizeof header->magic) == 0;
+	is_valid = is_valid && header->entries_count <= (size - sizeof *header) / sizeof (struct rc_texpack_entry);
+	const struct rc_texpack_entry *entries = (const struct rc_texpack_entry *) (header + 1);
+	for (uint32_t i = 0; is_valid && i < header->entries_count; i++)
+		is_valid = entries[i].offset <= size && (uint64_t) entries[i].width * entries[i].height * 4 <= size - entries[i].offset;
+	if (!is_valid) {
+		rc_log(RC_LOG_WARN, "Texture pack '%s' is invalid, textures will be decoded instead", filename);
+		munmap(mapping, size);
+		return false;
+	}
+
+	pack_data = mapping;
+	pack_size = size;
+	rc_log(RC_LOG_INFO, "Mounted %u textures from '%s'", header->entries_count, filename);
+	return true;
+#else
+	rc_log(RC_LOG_WARN, "Texture packs are not supported on this platform, textures will be decoded instead");
+	return false;
+#endif
+}
+
+void rc_texture_unmount_pack(void) {
+	if (!pack_data)
+		return;
+	rc_log(RC_LOG_INFO, "Unmounting texture pack...");
+#ifdef RC_LINUX
+	munmap((void *) pack_data, pack_size);
+#endif
+	pack_data = NULL;
+	pack_size = 0;
+}
+
 void rc_texture_get_dimensions(const struct rc_texture *texture, int *width, int *height) {
 	*width = texture->width;
 	*height = texture->height;
@@ -36,6 +233,84 @@ void rc_texture_get_pixel(const struct rc_texture *texture, int x, int y, unsign
 
 void rc_texture_unload(struct rc_texture *texture) {
 	rc_log(RC_LOG_VERBOSE, "Unloading texture...");
-	stbi_image_free(texture->data);
+	if (!texture->is_packed)
+		stbi_image_free(texture->data);
+	free(texture->indices);
+	free(texture->column_spans);
+	free(texture->spans);
 	free(texture);
 }
+
+static const struct rc_texpack_entry *rc_texture_internal_find_packed(const char *filename) {
+	if (!pack_data)
+		return NULL;
+	const struct rc_texpack_header *header = (const struct rc_texpack_header *) pack_data;
+	const struct rc_texpack_entry *entries = (const struct rc_texpack_entry *) (header + 1);
+	for (uint32_t i = 0; i < header->entries_count; i++)
+		if (strncmp(entries[i].filename, filename, RC_TEXPACK_MAX_FILENAME) == 0)
+			return &entries[i];
+	return NULL;
+}
+
+static void rc_texture_internal_find_spans(struct rc_texture *texture) {
+	texture->column_spans = malloc(sizeof *texture->column_spans * (texture->width + 1));
+	RC_ASSERT(texture->column_spans);
+
+	// Count the spans first so they can be stored in one array
+	int spans_count = 0;
+	for (int x = 0; x < texture->width; x++) {
+		texture->column_spans[x] = spans_count;
+		for (int y = 0; y < texture->height; y++)
+			if (texture->data[4 * (y * texture->width + x) + 3] && (y == 0 || !texture->data[4 * ((y - 1) * texture->width + x) + 3]))
+				spans_count++;
+	}
+	texture->column_spans[texture->width] = spans_count;
+
+	texture->spans = malloc(sizeof *texture->spans * ((spans_count) ? spans_count : 1));
+	RC_ASSERT(texture->spans);
+	for (int x = 0, span = 0; x < texture->width; x++) {
+		for (int y = 0; y < texture->height; y++) {
+			if (!texture->data[4 * (y * texture->width + x) + 3])
+				continue;
+			const int first = y;
+			while (y < texture->height && texture->data[4 * (y * texture->width + x) + 3])
+				y++;
+			texture->spans[span++] = (struct rc_texture_span) { first, y };
+		}
+	}
+}
+
+static void rc_texture_internal_measure_box(const struct rc_texture *texture, const int *texels, struct rc_texture_box *box) {
+	for (int channel = 0; channel < 4; channel++)
+		box->min[channel] = 0xff, box->max[channel] = 0;
+	for (int i = box->first; i < box->first + box->count; i++) {
+		const unsigned char *texel = &texture->data[4 * texels[i]];
+		for (int channel = 0; channel < 4; channel++) {
+			if (texel[channel] < box->min[channel]) box->min[channel] = texel[channel];
+			if (texel[channel] > box->max[channel]) box->max[channel] = texel[channel];
+		}
+	}
+}
+
+// Partition the texels of a box around the median of a channel, returning how many are in the lower half
+// The channel must vary within the box, so both halves are never empty
+static int rc_texture_internal_split_box(const struct rc_texture *texture, int *texels, const struct rc_texture_box *box, int channel) {
+	int histogram[256] = { 0 };
+	for (int i = box->first; i < box->first + box->count; i++)
+		histogram[texture->data[4 * texels[i] + channel]]++;
+	int median = box->min[channel], lower_count = histogram[median];
+	while (median + 1 < box->max[channel] && lower_count * 2 < box->count)
+		lower_count += histogram[++median];
+
+	int lower = box->first, upper = box->first + box->count - 1;
+	while (lower <= upper) {
+		if (texture->data[4 * texels[lower] + channel] <= median) {
+			lower++;
+		} else {
+			const int texel = texels[lower];
+			texels[lower] = texels[upper];
+			texels[upper--] = texel;
+		}
+	}
+	return lower_count;
+}
@@ -1,9 +1,23 @@
 #ifndef RC_TEXTURE_H
 #define RC_TEXTURE_H
 
+#include <stdbool.h>
+
 struct rc_texture;
 
+// Texels [first, end) of a column
+struct rc_texture_span {
+	unsigned short first, end;
+};
+
 struct rc_texture *rc_texture_load(const char *filename);
+bool rc_texture_mount_pack(const char *filename);
+void rc_texture_unmount_pack(void);
+void rc_texture_quantize(struct rc_texture *texture, int colors_count);
+const unsigned char *rc_texture_get_indices(const struct rc_texture *texture);
+const unsigned char *rc_texture_get_pixels(const struct rc_texture *texture);
+const unsigned char *rc_texture_get_palette(const struct rc_texture *texture, int *colors_count);
+const struct rc_texture_span *rc_texture_get_column_spans(const struct rc_texture *texture, int x, int *spans_count);
 void rc_texture_get_dimensions(const struct rc_texture *texture, int *width, int *height);
 void rc_texture_get_pixel(const struct rc_texture *texture, int x, int y, unsigned char *r, unsigned char *g, unsigned char *b, unsigned char *a);
 void rc_texture_unload(struct rc_texture *texture);
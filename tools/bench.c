@@ -0,0 +1,365 @@
+// Deterministic flythrough benchmark - replays a scripted camera path through a fixed map with a headless renderer
+// Usage: bench [-c] [-m] [-T tile columns] [-w reference directory | -r reference directory] [-t tolerance] [-s baseline | -b baseline] [-p percent] [frames]
+// Prints one JSON object per line for each resolution, FOV and texture mode measured
+// With -c, hardware performance counters per frame are added for each renderer pass
+// With -m, frames are drawn column-major and transposed afterwards
+// With -T, the screen is drawn in tiles of that many columns on every core
+// With -w, frames of fixed poses are saved into the directory, creating it if needed, for a later run with -r to check against
+// -r fails if over 1% of the pixels of any pose differ by more than the channel tolerance from their reference pixel and its neighbours
+// With -s, the time per frame of each setting is saved into the baseline file for a later run with -b to check against
+// -b fails if any setting is slower than the baseline by more than the percentage
+// Set RC_KERNELS to measure render kernels other than the best ones this CPU supports
+
+#include "platform.h"
+#include "renderer.h"
+#include "texture.h"
+#include "entity.h"
+#include "map.h"
+#include "light.h"
+#include "timer.h"
+#include "counters.h"
+#include "kernels.h"
+#include "logging.h"
+#include "jobs.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <errno.h>
+#ifdef RC_LINUX
+#include <sys/stat.h>
+#elif defined RC_WINDOWS
+#include <direct.h>
+#endif
+
+#define BENCH_MAP_SIZE 24
+#define BENCH_WARMUP_FRAMES 10
+#define BENCH_TEXTURE_COLORS 64
+#define BENCH_POSES_COUNT 8
+#define BENCH_POSES_PHASE 0.3
+#define BENCH_MAX_MISMATCHED_PIXELS 0.01
+#define BENCH_MAX_FILENAME 256
+
+static const char *wall_texture_filenames[8] = {
+	"res/textures/wood.png",
+	"res/textures/greystone.png",
+	"res/textures/mossy.png",
+	"res/textures/bluestone.png",
+	"res/textures/purplestone.png",
+	"res/textures/colorstone.png",
+	"res/textures/redbrick.png",
+	"res/textures/eagle.png"
+};
+
+static const int resolutions[] = { 100, 200, 400 };
+static const double fovs[] = { 60, 90 };
+
+// A walled hall with a pillar every four tiles, so every view has walls at many distances
+static struct rc_map *create_map(void) {
+	int floor[BENCH_MAP_SIZE * BENCH_MAP_SIZE], walls[BENCH_MAP_SIZE * BENCH_MAP_SIZE], ceiling[BENCH_MAP_SIZE * BENCH_MAP_SIZE];
+	for (int y = 0; y < BENCH_MAP_SIZE; y++) {
+		for (int x = 0; x < BENCH_MAP_SIZE; x++) {
+			const int i = y * BENCH_MAP_SIZE + x;
+			const bool is_border = x == 0 || y == 0 || x == BENCH_MAP_SIZE - 1 || y == BENCH_MAP_SIZE - 1;
+			const bool is_pillar = x % 4 == 0 && y % 4 == 0;
+			floor[i] = (x / 4 + y / 4) % 2;
+			walls[i] = (is_border || is_pillar) ? (x / 4 + y / 4) % 8 : -1;
+			ceiling[i] = 3 + (x / 8 + y / 8) % 2;
+		}
+	}
+	return rc_map_create(BENCH_MAP_SIZE, BENCH_MAP_SIZE, floor, walls, ceiling);
+}
+
+// The directory may already exist, but its parent must
+static bool create_directory(const char *directory) {
+#ifdef RC_LINUX
+	return mkdir(directory, 0777) == 0 || errno == EEXIST;
+#elif defined RC_WINDOWS
+	return _mkdir(directory) == 0 || errno == EEXIST;
+#endif
+}
+
+// Reference frames are saved as binary PPMs, flipped so they are the right way up in an image viewer
+static bool write_frame(const char *filename, const unsigned char *pixels, int width, int height) {
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+		return false;
+	fprintf(file, "P6\n%i %i\n255\n", width, height);
+	for (int row = height - 1; row >= 0; row--)
+		for (int column = 0; column < width; column++)
+			fwrite(&pixels[4 * (row * width + column)], 1, 3, file);
+	return fclose(file) == 0;
+}
+
+// Whether any channel of two pixels differs by more than the tolerance
+static bool is_mismatched(const unsigned char *pixel, const unsigned char *reference, int tolerance) {
+	for (int channel = 0; channel < 3; channel++)
+		if (abs(pixel[channel] - reference[channel]) > tolerance)
+			return true;
+	return false;
+}
+
+// Returns the fraction of pixels with a channel differing from the reference by more than the tolerance, or -1 if it can't be compared
+// A pixel matching a neighbour of its reference pixel still matches, so edges rounded a pixel over on another toolchain don't fail
+static double compare_frame(const char *filename, const unsigned char *pixels, int width, int height, int tolerance) {
+	FILE *file = fopen(filename, "rb");
+	if (!file)
+		return -1;
+	int reference_width, reference_height, max_value;
+	if (fscanf(file, "P6 %i %i %i", &reference_width, &reference_height, &max_value) != 3 || fgetc(file) == EOF || reference_width != width || reference_height != height || max_value != 255) {
+		fclose(file);
+		return -1;
+	}
+	unsigned char *reference = malloc(3 * width * height);
+	if (!reference || fread(reference, 3, width * height, file) != width * height) {
+		free(reference);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	// References are flipped, so their rows run the other way
+	int mismatched_pixels_count = 0;
+	for (int row = 0; row < height; row++) {
+		for (int column = 0; column < width; column++) {
+			const unsigned char *pixel = &pixels[4 * (row * width + column)];
+			bool is_matched = false;
+			for (int neighbour_row = row - 1; neighbour_row <= row + 1 && !is_matched; neighbour_row++)
+				for (int neighbour_column = column - 1; neighbour_column <= column + 1 && !is_matched; neighbour_column++)
+					if (neighbour_row >= 0 && neighbour_row < height && neighbour_column >= 0 && neighbour_column < width)
+						is_matched = !is_mismatched(pixel, &reference[3 * ((height - 1 - neighbour_row) * width + neighbour_column)], tolerance);
+			if (!is_matched)
+				mismatched_pixels_count++;
+		}
+	}
+	free(reference);
+	return (double) mismatched_pixels_count / (width * height);
+}
+
+// The camera loops around the hall once over the run, looking from side to side as it goes
+static void get_camera_transform(double t, double *x, double *y, double *r) {
+	const double near = 2.5, far = BENCH_MAP_SIZE - 2.5, length = far - near;
+	const double distance = 4 * length * t;
+	const int side = distance / length;
+	const double offset = distance - side * length;
+	switch (side % 4) {
+		case 0:  *x = near + offset; *y = near;          *r = DEG2RAD(0);   break;
+		case 1:  *x = far;           *y = near + offset; *r = DEG2RAD(90);  break;
+		case 2:  *x = far - offset;  *y = far;           *r = DEG2RAD(180); break;
+		default: *x = near;          *y = far - offset;  *r = DEG2RAD(270); break;
+	}
+	*r += DEG2RAD(45) * sin(2 * PI * 8 * t);
+}
+
+int main(int argc, char **argv) {
+	int frames_count = 300, tolerance = 8, tile_columns = 0;
+	double max_regression = 10;
+	bool is_counting = false, is_column_major = false, is_writing_references = false, is_writing_baseline = false;
+	const char *reference_directory = NULL, *baseline_filename = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c")) {
+			is_counting = true;
+		} else if (!strcmp(argv[i], "-m")) {
+			is_column_major = true;
+		} else if ((!strcmp(argv[i], "-w") || !strcmp(argv[i], "-r")) && i + 1 < argc) {
+			is_writing_references = argv[i][1] == 'w';
+			reference_directory = argv[++i];
+		} else if ((!strcmp(argv[i], "-s") || !strcmp(argv[i], "-b")) && i + 1 < argc) {
+			is_writing_baseline = argv[i][1] == 's';
+			baseline_filename = argv[++i];
+		} else if (!strcmp(argv[i], "-T") && i + 1 < argc) {
+			tile_columns = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			tolerance = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			max_regression = atof(argv[++i]);
+		} else {
+			frames_count = atoi(argv[i]);
+		}
+	}
+	if (frames_count < 1 || tile_columns < 0) {
+		fprintf(stderr, "Usage: %s [-c] [-m] [-T tile columns] [-w reference directory | -r reference directory] [-t tolerance] [-s baseline | -b baseline] [-p percent] [frames]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (is_writing_references && !create_directory(reference_directory)) {
+		fprintf(stderr, "Could not create reference directory '%s': %s\n", reference_directory, strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	// Warnings and errors go to stderr, so stdout only holds results
+	rc_log_set_output(stderr, RC_LOG_WARN);
+	rc_log_init();
+	rc_kernels_init();
+
+	// Counters are often unavailable in containers and virtual machines, the benchmark still runs without them
+	if (is_counting && !rc_counters_init()) {
+		fprintf(stderr, "Hardware performance counters are unavailable!\n");
+		is_counting = false;
+	}
+
+	// Load and quantize textures up front so both texture modes can be measured
+	struct rc_texture *wall_textures[8];
+	for (int i = 0; i < 8; i++) {
+		wall_textures[i] = rc_texture_load(wall_texture_filenames[i]);
+		rc_texture_quantize(wall_textures[i], BENCH_TEXTURE_COLORS);
+	}
+	struct rc_texture *barrel_texture = rc_texture_load("res/textures/barrel.png");
+	rc_texture_quantize(barrel_texture, BENCH_TEXTURE_COLORS);
+
+	// Light the map once, nothing moves during the run
+	struct rc_map *map = create_map();
+	struct rc_light *lights[4] = {
+		rc_light_create(6,  6,  0xff, 0x40, 0x40, 10, 5.0),
+		rc_light_create(17, 6,  0x40, 0xff, 0x40, 10, 5.0),
+		rc_light_create(6,  17, 0x40, 0x40, 0xff, 10, 5.0),
+		rc_light_create(17, 17, 0xff, 0xff, 0xff, 10, 5.0)
+	};
+	rc_map_set_ambient_lighting(map, 0x10, 0x10, 0x10);
+	for (int i = 0; i < 4; i++)
+		rc_map_add_light(map, lights[i]);
+	rc_map_update_lighting(map);
+
+	// Barrels fill the middle of the hall between the pillars
+	struct rc_entity_pool *entities = rc_entity_pool_create(32, map);
+	const struct rc_entity_handle camera = rc_entity_create(entities, 2.5, 2.5, 0.5, 0.0, NULL, RC_ENTITY_BEHAVIOR_NONE);
+	for (int y = 5; y < BENCH_MAP_SIZE - 4; y += 4)
+		for (int x = 5; x < BENCH_MAP_SIZE - 4; x += 4)
+			rc_entity_create(entities, x + 0.5, y + 0.5, 0.5, 0.0, barrel_texture, RC_ENTITY_BEHAVIOR_NONE);
+
+	struct rc_renderer *renderer = rc_renderer_create_headless(16.0 / 9.0, resolutions[0], DEG2RAD(fovs[0]), wall_textures, 8);
+	struct rc_job_system *jobs = (tile_columns) ? rc_job_system_create(0) : NULL;
+	rc_renderer_set_tiles(renderer, tile_columns, jobs);
+	rc_renderer_set_column_major(renderer, is_column_major);
+
+	// Draw the fixed poses, then save them as references or check them against the saved references
+	// Poses sit between the evenly spaced points of the path - at those points the camera is square to the walls and in line with
+	// the barrels, so rounding ties would leave the frames depending on the toolchain
+	bool is_passing = true;
+	char filename[BENCH_MAX_FILENAME];
+	for (int is_palettized = 0; reference_directory && is_palettized <= 1; is_palettized++) {
+		rc_renderer_set_resolution(renderer, resolutions[1]);
+		rc_renderer_set_fov(renderer, DEG2RAD(fovs[0]));
+		rc_renderer_set_palettized(renderer, is_palettized);
+		for (int pose = 0; pose < BENCH_POSES_COUNT; pose++) {
+			double x, y, r;
+			get_camera_transform((pose + BENCH_POSES_PHASE) / BENCH_POSES_COUNT, &x, &y, &r);
+			rc_entity_set_transform(entities, camera, x, y, 0.5, r);
+			rc_renderer_draw(renderer, map, entities, camera, 1.0);
+
+			int width, height;
+			const unsigned char *pixels = rc_renderer_get_pixels(renderer, &width, &height);
+			snprintf(filename, sizeof filename, "%s/pose_%i%s.ppm", reference_directory, pose, (is_palettized) ? "_palettized" : "");
+			if (is_writing_references) {
+				if (!write_frame(filename, pixels, width, height)) {
+					fprintf(stderr, "Could not write reference frame '%s'!\n", filename);
+					return EXIT_FAILURE;
+				}
+				continue;
+			}
+			const double mismatched_pixels = compare_frame(filename, pixels, width, height, tolerance);
+			if (mismatched_pixels < 0) {
+				fprintf(stderr, "Could not compare against reference frame '%s'!\n", filename);
+				is_passing = false;
+			} else if (mismatched_pixels > BENCH_MAX_MISMATCHED_PIXELS) {
+				fprintf(stderr, "Frame differs from '%s' in %.2f%% of pixels!\n", filename, 100 * mismatched_pixels);
+				is_passing = false;
+			}
+		}
+	}
+
+	// The time per frame of each setting is kept to save or check against the baseline
+	double frame_times[sizeof resolutions / sizeof *resolutions][sizeof fovs / sizeof *fovs][2];
+	struct rc_timer *timer = rc_timer_create();
+	for (int i = 0; i < sizeof resolutions / sizeof *resolutions; i++) {
+		for (int j = 0; j < sizeof fovs / sizeof *fovs; j++) {
+			for (int is_palettized = 0; is_palettized <= 1; is_palettized++) {
+				rc_renderer_set_resolution(renderer, resolutions[i]);
+				rc_renderer_set_fov(renderer, DEG2RAD(fovs[j]));
+				rc_renderer_set_palettized(renderer, is_palettized);
+
+				// Warm up caches and the branch predictor on the start of the path before timing
+				double x, y, r;
+				for (int frame = 0; frame < BENCH_WARMUP_FRAMES; frame++) {
+					get_camera_transform((double) frame / frames_count, &x, &y, &r);
+					rc_entity_set_transform(entities, camera, x, y, 0.5, r);
+					rc_renderer_draw(renderer, map, entities, camera, 1.0);
+				}
+
+				rc_counters_reset();
+				rc_timer_reset(timer);
+				for (int frame = 0; frame < frames_count; frame++) {
+					get_camera_transform((double) frame / frames_count, &x, &y, &r);
+					rc_entity_set_transform(entities, camera, x, y, 0.5, r);
+					rc_renderer_draw(renderer, map, entities, camera, 1.0);
+				}
+				const double elapsed = rc_timer_measure(timer);
+				frame_times[i][j][is_palettized] = 1000 * elapsed / frames_count;
+
+				// Every column casts one ray for its wall
+				int width, height;
+				rc_renderer_get_pixels(renderer, &width, &height);
+				printf(
+					"{\"benchmark\": \"flythrough\", \"kernels\": \"%s\", \"resolution\": %i, \"fov\": %.0f, \"palettized\": %s, \"column_major\": %s, \"tile_columns\": %i, \"width\": %i, \"height\": %i, \"frames\": %i, "
+					"\"ms_per_frame\": %.4f, \"mpixels_per_s\": %.2f, \"rays_per_s\": %.0f",
+					rc_kernels_get_isa_name(rc_kernels_get_isa()), resolutions[i], fovs[j], (is_palettized) ? "true" : "false", (is_column_major) ? "true" : "false", tile_columns, width, height, frames_count,
+					1000 * elapsed / frames_count, (double) width * height * frames_count / elapsed / 1000000, (double) width * frames_count / elapsed);
+				if (is_counting) {
+					printf(", \"counters\": ");
+					rc_counters_write_json(stdout, frames_count);
+				}
+				printf("}\n");
+				fflush(stdout);
+			}
+		}
+	}
+
+	// The baseline has a line with the time per frame for each setting
+	if (baseline_filename) {
+		FILE *file = fopen(baseline_filename, (is_writing_baseline) ? "w" : "r");
+		if (!file) {
+			fprintf(stderr, "Could not open baseline '%s'!\n", baseline_filename);
+			is_passing = false;
+		} else if (is_writing_baseline) {
+			for (int i = 0; i < sizeof resolutions / sizeof *resolutions; i++)
+				for (int j = 0; j < sizeof fovs / sizeof *fovs; j++)
+					for (int is_palettized = 0; is_palettized <= 1; is_palettized++)
+						fprintf(file, "%i %.0f %i %.6f\n", resolutions[i], fovs[j], is_palettized, frame_times[i][j][is_palettized]);
+			fclose(file);
+		} else {
+			int resolution, is_palettized;
+			double fov, baseline_frame_time;
+			while (fscanf(file, "%i %lf %i %lf", &resolution, &fov, &is_palettized, &baseline_frame_time) == 4) {
+				for (int i = 0; i < sizeof resolutions / sizeof *resolutions; i++) {
+					for (int j = 0; j < sizeof fovs / sizeof *fovs; j++) {
+						if (resolution != resolutions[i] || fov != fovs[j] || is_palettized < 0 || is_palettized > 1)
+							continue;
+						const double frame_time = frame_times[i][j][is_palettized];
+						if (frame_time > baseline_frame_time * (1 + max_regression / 100)) {
+							fprintf(stderr, "Resolution %i, FOV %.0f%s regressed from %.4fms to %.4fms per frame!\n", resolution, fov, (is_palettized) ? " palettized" : "", baseline_frame_time, frame_time);
+							is_passing = false;
+						}
+					}
+				}
+			}
+			fclose(file);
+		}
+	}
+	if ((reference_directory && !is_writing_references) || (baseline_filename && !is_writing_baseline))
+		fprintf(stderr, "Regression check %s.\n", (is_passing) ? "passed" : "failed");
+
+	rc_counters_cleanup();
+	rc_timer_destroy(timer);
+	rc_renderer_destroy(renderer);
+	if (jobs)
+		rc_job_system_destroy(jobs);
+	rc_entity_pool_destroy(entities);
+	rc_map_destroy(map);
+	for (int i = 0; i < 4; i++)
+		rc_light_destroy(lights[i]);
+	for (int i = 0; i < 8; i++)
+		rc_texture_unload(wall_textures[i]);
+	rc_texture_unload(barrel_texture);
+	rc_log_cleanup();
+	return (is_passing) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
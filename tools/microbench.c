@@ -0,0 +1,395 @@
+// Per-subsystem microbenchmarks - times the raycaster, each renderer pass, lighting and texture sampling in isolation
+// Usage: microbench [-c] [-w warmup iterations] [-i timed iterations] [benchmark name]
+// Prints a JSON document with one result per line, so runs can be diffed against each other
+// With -c, hardware performance counters per iteration are added for the renderer passes and lighting
+// Set RC_KERNELS to measure render kernels other than the best ones this CPU supports
+
+#include "platform.h"
+#include "renderer.h"
+#include "texture.h"
+#include "entity.h"
+#include "map.h"
+#include "light.h"
+#include "timer.h"
+#include "counters.h"
+#include "kernels.h"
+#include "logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#define RAYS_COUNT 4096
+#define SAMPLES_COUNT 65536
+
+struct benchmark {
+	const char *name;
+	char case_name[64];
+	double ops_per_iteration;
+	void (*run)(void *context);
+	void *context;
+};
+
+struct raycast_context {
+	const struct rc_map *map;
+	double x[RAYS_COUNT], y[RAYS_COUNT], a[RAYS_COUNT];
+};
+
+struct render_context {
+	struct rc_renderer *renderer;
+	const struct rc_map *map;
+	const struct rc_entity_pool *entities;
+	struct rc_entity_handle camera;
+};
+
+struct lighting_context {
+	const struct rc_map *map;
+	struct rc_light **lights;
+	int lights_count;
+};
+
+struct sampling_context {
+	const struct rc_texture *texture;
+	unsigned short x[SAMPLES_COUNT], y[SAMPLES_COUNT];
+};
+
+static const char *wall_texture_filenames[8] = {
+	"res/textures/wood.png",
+	"res/textures/greystone.png",
+	"res/textures/mossy.png",
+	"res/textures/bluestone.png",
+	"res/textures/purplestone.png",
+	"res/textures/colorstone.png",
+	"res/textures/redbrick.png",
+	"res/textures/eagle.png"
+};
+
+static const int map_sizes[] = { 32, 64, 128 };
+static const int lights_counts[] = { 1, 8, 32 };
+static const int sprites_counts[] = { 1, 16, 128 };
+
+// Results are summed in here so the compiler can't throw the work away
+static volatile double sink;
+static bool is_counting = false;
+
+// Fixed generator so maps are the same on every platform
+static unsigned random_state;
+static double next_random(void) {
+	random_state = random_state * 1664525u + 1013904223u;
+	return (random_state >> 8) / 16777216.0;
+}
+
+static bool is_border(int size, int x, int y) {
+	return x == 0 || y == 0 || x == size - 1 || y == size - 1;
+}
+
+// Only the outer walls, so rays travel the whole map
+static struct rc_map *create_open_map(int size) {
+	int *floor = malloc(sizeof *floor * size * size), *walls = malloc(sizeof *walls * size * size), *ceiling = malloc(sizeof *ceiling * size * size);
+	for (int i = 0; i < size * size; i++) {
+		floor[i] = i % 2;
+		walls[i] = is_border(size, i % size, i / size) ? i % 8 : -1;
+		ceiling[i] = 3 + i % 2;
+	}
+	struct rc_map *map = rc_map_create(size, size, floor, walls, ceiling);
+	free(floor); free(walls); free(ceiling);
+	return map;
+}
+
+// A pillar every four tiles
+static struct rc_map *create_pillar_map(int size) {
+	int *floor = malloc(sizeof *floor * size * size), *walls = malloc(sizeof *walls * size * size), *ceiling = malloc(sizeof *ceiling * size * size);
+	for (int i = 0; i < size * size; i++) {
+		const int x = i % size, y = i / size;
+		floor[i] = (x / 4 + y / 4) % 2;
+		walls[i] = (is_border(size, x, y) || (x % 4 == 0 && y % 4 == 0)) ? (x / 4 + y / 4) % 8 : -1;
+		ceiling[i] = 3 + (x / 8 + y / 8) % 2;
+	}
+	struct rc_map *map = rc_map_create(size, size, floor, walls, ceiling);
+	free(floor); free(walls); free(ceiling);
+	return map;
+}
+
+// Randomly scattered walls covering roughly the given fraction of the map, so rays stop after a few tiles
+static struct rc_map *create_dense_map(int size, double density) {
+	int *floor = malloc(sizeof *floor * size * size), *walls = malloc(sizeof *walls * size * size), *ceiling = malloc(sizeof *ceiling * size * size);
+	random_state = size;
+	for (int i = 0; i < size * size; i++) {
+		floor[i] = next_random() * 8;
+		walls[i] = (is_border(size, i % size, i / size) || next_random() < density) ? (int) (next_random() * 8) : -1;
+		ceiling[i] = next_random() * 8;
+	}
+	struct rc_map *map = rc_map_create(size, size, floor, walls, ceiling);
+	free(floor); free(walls); free(ceiling);
+	return map;
+}
+
+// Pick a random tile without a wall
+static void get_random_open_tile(const struct rc_map *map, int *x, int *y) {
+	int width, height;
+	rc_map_get_size(map, &width, &height);
+	do {
+		*x = next_random() * width;
+		*y = next_random() * height;
+	} while (rc_map_get_wall(map, *x, *y) != -1);
+}
+
+static void run_raycast(void *context) {
+	const struct raycast_context *raycast = context;
+	double total = 0;
+	for (int i = 0; i < RAYS_COUNT; i++) {
+		int hit_x, hit_y, hit_side;
+		double hit_dst, hit_lat;
+		rc_map_raycast(raycast->map, raycast->x[i], raycast->y[i], raycast->a[i], &hit_x, &hit_y, &hit_side, &hit_dst, &hit_lat);
+		total += hit_dst;
+	}
+	sink += total;
+}
+
+static void run_render(void *context) {
+	const struct render_context *render = context;
+	rc_renderer_draw(render->renderer, render->map, render->entities, render->camera, 1.0);
+}
+
+static void run_lighting(void *context) {
+	const struct lighting_context *lighting = context;
+	rc_map_generate_lighting(lighting->map, 0x10, 0x10, 0x10, lighting->lights, lighting->lights_count);
+}
+
+static void run_sampling(void *context) {
+	const struct sampling_context *sampling = context;
+	unsigned total = 0;
+	for (int i = 0; i < SAMPLES_COUNT; i++) {
+		unsigned char r, g, b, a;
+		rc_texture_get_pixel(sampling->texture, sampling->x[i], sampling->y[i], &r, &g, &b, &a);
+		total += r + g + b + a;
+	}
+	sink += total;
+}
+
+// Time each iteration on its own so the fastest one shows the cost without interference
+static void measure(const struct benchmark *benchmark, int warmup_iterations, int iterations, bool is_first_result) {
+	for (int i = 0; i < warmup_iterations; i++)
+		benchmark->run(benchmark->context);
+
+	double total_time = 0, min_time = INFINITY;
+	struct rc_timer *timer = rc_timer_create();
+	rc_counters_reset();
+	for (int i = 0; i < iterations; i++) {
+		rc_timer_reset(timer);
+		benchmark->run(benchmark->context);
+		const double time = rc_timer_measure(timer);
+		total_time += time;
+		min_time = fmin(min_time, time);
+	}
+	rc_timer_destroy(timer);
+
+	const double mean_time = total_time / iterations;
+	printf(
+		"%s\n\t{\"benchmark\": \"%s\", \"case\": \"%s\", \"ops_per_iteration\": %.0f, \"mean_ms\": %.6f, \"min_ms\": %.6f, \"ops_per_s\": %.0f",
+		(is_first_result) ? "" : ",", benchmark->name, benchmark->case_name, benchmark->ops_per_iteration,
+		1000 * mean_time, 1000 * min_time, benchmark->ops_per_iteration / mean_time);
+	if (is_counting) {
+		printf(", \"counters\": ");
+		rc_counters_write_json(stdout, iterations);
+	}
+	printf("}");
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	int warmup_iterations = 5, iterations = 50;
+	const char *filter = NULL;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-c")) {
+			is_counting = true;
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			warmup_iterations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-i") && i + 1 < argc) {
+			iterations = atoi(argv[++i]);
+		} else if (argv[i][0] != '-' && !filter) {
+			filter = argv[i];
+		} else {
+			fprintf(stderr, "Usage: %s [-c] [-w warmup iterations] [-i timed iterations] [benchmark name]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (warmup_iterations < 0 || iterations < 1) {
+		fprintf(stderr, "There must be at least one timed iteration!\n");
+		return EXIT_FAILURE;
+	}
+
+	// Warnings and errors go to stderr, so stdout only holds results
+	rc_log_set_output(stderr, RC_LOG_WARN);
+	rc_log_init();
+	rc_kernels_init();
+
+	// Counters are often unavailable in containers and virtual machines, the benchmarks still run without them
+	if (is_counting && !rc_counters_init()) {
+		fprintf(stderr, "Hardware performance counters are unavailable!\n");
+		is_counting = false;
+	}
+
+	struct rc_texture *wall_textures[8];
+	for (int i = 0; i < 8; i++)
+		wall_textures[i] = rc_texture_load(wall_texture_filenames[i]);
+	struct rc_texture *barrel_texture = rc_texture_load("res/textures/barrel.png");
+
+	printf("{\"kernels\": \"%s\", \"warmup_iterations\": %i, \"iterations\": %i, \"results\": [", rc_kernels_get_isa_name(rc_kernels_get_isa()), warmup_iterations, iterations);
+	bool is_first_result = true;
+
+	// Rays from random open tiles in random directions
+	if (!filter || !strcmp(filter, "raycast")) {
+		for (int i = 0; i < 3; i++) {
+			struct rc_map *map = (i == 0) ? create_open_map(64) : (i == 1) ? create_pillar_map(64) : create_dense_map(64, 0.4);
+			struct raycast_context *context = malloc(sizeof *context);
+			context->map = map;
+			random_state = 1;
+			for (int j = 0; j < RAYS_COUNT; j++) {
+				int x, y;
+				get_random_open_tile(map, &x, &y);
+				context->x[j] = x + next_random();
+				context->y[j] = y + next_random();
+				context->a[j] = 2 * PI * next_random();
+			}
+			struct benchmark benchmark = { "raycast", "", RAYS_COUNT, run_raycast, context };
+			snprintf(benchmark.case_name, sizeof benchmark.case_name, "%s 64x64", (i == 0) ? "open" : (i == 1) ? "pillars" : "dense");
+			measure(&benchmark, warmup_iterations, iterations, is_first_result);
+			is_first_result = false;
+			free(context);
+			rc_map_destroy(map);
+		}
+	}
+
+	// The floor and ceiling pass on its own, looking down the length of a lit hall
+	if (!filter || !strcmp(filter, "floor_and_ceiling")) {
+		struct rc_map *map = create_pillar_map(32);
+		struct rc_light *light = rc_light_create(16, 16, 0xff, 0xff, 0xff, 16, 5.0);
+		rc_map_add_light(map, light);
+		rc_map_update_lighting(map);
+		struct rc_entity_pool *entities = rc_entity_pool_create(1, map);
+		const struct rc_entity_handle camera = rc_entity_create(entities, 2.5, 2.5, 0.5, DEG2RAD(45), NULL, RC_ENTITY_BEHAVIOR_NONE);
+		struct rc_renderer *renderer = rc_renderer_create_headless(16.0 / 9.0, 200, DEG2RAD(60), wall_textures, 8);
+		rc_renderer_set_passes(renderer, RC_RENDERER_PASS_FLOOR_AND_CEILING);
+		int width, height;
+		rc_renderer_get_pixels(renderer, &width, &height);
+		struct render_context context = { renderer, map, entities, camera };
+		struct benchmark benchmark = { "floor_and_ceiling", "", width * height, run_render, &context };
+		snprintf(benchmark.case_name, sizeof benchmark.case_name, "%ix%i pixels", width, height);
+		measure(&benchmark, warmup_iterations, iterations, is_first_result);
+		is_first_result = false;
+		rc_renderer_destroy(renderer);
+		rc_entity_pool_destroy(entities);
+		rc_map_destroy(map);
+		rc_light_destroy(light);
+	}
+
+	// The wall pass on its own, from the middle of each map so columns cover the whole range of distances
+	if (!filter || !strcmp(filter, "walls")) {
+		for (int i = 0; i < 3; i++) {
+			struct rc_map *map = (i == 0) ? create_open_map(32) : (i == 1) ? create_pillar_map(32) : create_dense_map(32, 0.4);
+			rc_map_update_lighting(map);
+			struct rc_entity_pool *entities = rc_entity_pool_create(1, map);
+			random_state = 1;
+			int x, y;
+			get_random_open_tile(map, &x, &y);
+			const struct rc_entity_handle camera = rc_entity_create(entities, x + 0.5, y + 0.5, 0.5, DEG2RAD(30), NULL, RC_ENTITY_BEHAVIOR_NONE);
+			struct rc_renderer *renderer = rc_renderer_create_headless(16.0 / 9.0, 200, DEG2RAD(60), wall_textures, 8);
+			rc_renderer_set_passes(renderer, RC_RENDERER_PASS_WALLS);
+			int width, height;
+			rc_renderer_get_pixels(renderer, &width, &height);
+			struct render_context context = { renderer, map, entities, camera };
+			struct benchmark benchmark = { "walls", "", width, run_render, &context };
+			snprintf(benchmark.case_name, sizeof benchmark.case_name, "%s 32x32 %i columns", (i == 0) ? "open" : (i == 1) ? "pillars" : "dense", width);
+			measure(&benchmark, warmup_iterations, iterations, is_first_result);
+			is_first_result = false;
+			rc_renderer_destroy(renderer);
+			rc_entity_pool_destroy(entities);
+			rc_map_destroy(map);
+		}
+	}
+
+	// The sprite pass on its own, with sprites scattered in front of the camera at varying depths
+	if (!filter || !strcmp(filter, "sprites")) {
+		for (int i = 0; i < sizeof sprites_counts / sizeof *sprites_counts; i++) {
+			struct rc_map *map = create_open_map(32);
+			rc_map_update_lighting(map);
+			struct rc_entity_pool *entities = rc_entity_pool_create(sprites_counts[i] + 1, map);
+			const struct rc_entity_handle camera = rc_entity_create(entities, 2.5, 16.0, 0.5, 0.0, NULL, RC_ENTITY_BEHAVIOR_NONE);
+			random_state = 1;
+			for (int j = 0; j < sprites_counts[i]; j++) {
+				const double distance = 2 + 20 * next_random(), angle = 0.8 * (next_random() - 0.5);
+				rc_entity_create(entities, 2.5 + distance * cos(angle), 16.0 + distance * sin(angle), 0.5, 0.0, barrel_texture, RC_ENTITY_BEHAVIOR_NONE);
+			}
+			struct rc_renderer *renderer = rc_renderer_create_headless(16.0 / 9.0, 200, DEG2RAD(60), wall_textures, 8);
+			rc_renderer_set_passes(renderer, RC_RENDERER_PASS_SPRITES);
+			struct render_context context = { renderer, map, entities, camera };
+			struct benchmark benchmark = { "sprites", "", sprites_counts[i], run_render, &context };
+			snprintf(benchmark.case_name, sizeof benchmark.case_name, "%i sprites", sprites_counts[i]);
+			measure(&benchmark, warmup_iterations, iterations, is_first_result);
+			is_first_result = false;
+			rc_renderer_destroy(renderer);
+			rc_entity_pool_destroy(entities);
+			rc_map_destroy(map);
+		}
+	}
+
+	// Regenerating all lighting from scratch in both lighting modes
+	if (!filter || !strcmp(filter, "lighting")) {
+		for (int mode = RC_MAP_LIGHTING_FLOOD; mode <= RC_MAP_LIGHTING_SHADOWCAST; mode++) {
+			for (int i = 0; i < sizeof map_sizes / sizeof *map_sizes; i++) {
+				for (int j = 0; j < sizeof lights_counts / sizeof *lights_counts; j++) {
+					struct rc_map *map = create_pillar_map(map_sizes[i]);
+					rc_map_set_lighting_mode(map, mode);
+					struct rc_light **lights = malloc(sizeof *lights * lights_counts[j]);
+					random_state = 1;
+					for (int k = 0; k < lights_counts[j]; k++) {
+						int x, y;
+						get_random_open_tile(map, &x, &y);
+						lights[k] = rc_light_create(x, y, next_random() * 0xff, next_random() * 0xff, next_random() * 0xff, 10, 5.0);
+					}
+					struct lighting_context context = { map, lights, lights_counts[j] };
+					struct benchmark benchmark = { "lighting", "", 1, run_lighting, &context };
+					snprintf(benchmark.case_name, sizeof benchmark.case_name, "%s %ix%i %i lights", (mode == RC_MAP_LIGHTING_FLOOD) ? "flood" : "shadowcast", map_sizes[i], map_sizes[i], lights_counts[j]);
+					measure(&benchmark, warmup_iterations, iterations, is_first_result);
+					is_first_result = false;
+					for (int k = 0; k < lights_counts[j]; k++)
+						rc_light_destroy(lights[k]);
+					free(lights);
+					rc_map_destroy(map);
+				}
+			}
+		}
+	}
+
+	// Texel fetches along rows like the floor pass, down columns like the wall and sprite passes, and scattered
+	if (!filter || !strcmp(filter, "texture_sampling")) {
+		int width, height;
+		rc_texture_get_dimensions(barrel_texture, &width, &height);
+		for (int pattern = 0; pattern < 3; pattern++) {
+			struct sampling_context *context = malloc(sizeof *context);
+			context->texture = barrel_texture;
+			random_state = 1;
+			for (int i = 0; i < SAMPLES_COUNT; i++) {
+				const int texel = i % (width * height);
+				context->x[i] = (pattern == 0) ? texel % width : (pattern == 1) ? texel / height : next_random() * width;
+				context->y[i] = (pattern == 0) ? texel / width : (pattern == 1) ? texel % height : next_random() * height;
+			}
+			struct benchmark benchmark = { "texture_sampling", "", SAMPLES_COUNT, run_sampling, context };
+			snprintf(benchmark.case_name, sizeof benchmark.case_name, "%s %ix%i", (pattern == 0) ? "rows" : (pattern == 1) ? "columns" : "random", width, height);
+			measure(&benchmark, warmup_iterations, iterations, is_first_result);
+			is_first_result = false;
+			free(context);
+		}
+	}
+
+	printf("\n]}\n");
+
+	rc_counters_cleanup();
+	for (int i = 0; i < 8; i++)
+		rc_texture_unload(wall_textures[i]);
+	rc_texture_unload(barrel_texture);
+	rc_log_cleanup();
+	return EXIT_SUCCESS;
+}
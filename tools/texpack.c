@@ -0,0 +1,85 @@
+// Offline texture packer - decodes every given image and writes them to a texture pack
+// Usage: texpack <pack file> <image files...>
+// Textures are looked up in the pack by the filenames given here, so pass them as the game would load them
+
+#include "texpack.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb/stb_image.h>
+
+static uint64_t align_offset(uint64_t offset) {
+	return (offset + RC_TEXPACK_ALIGNMENT - 1) / RC_TEXPACK_ALIGNMENT * RC_TEXPACK_ALIGNMENT;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <pack file> <image files...>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const int entries_count = argc - 2;
+	struct rc_texpack_entry *entries = calloc(entries_count ? entries_count : 1, sizeof *entries);
+	unsigned char **texels = calloc(entries_count ? entries_count : 1, sizeof *texels);
+	if (!entries || !texels) {
+		fprintf(stderr, "Out of memory!\n");
+		return EXIT_FAILURE;
+	}
+
+	// Decode everything first so the directory can be written before the texels
+	uint64_t offset = align_offset(sizeof (struct rc_texpack_header) + sizeof *entries * entries_count);
+	for (int i = 0; i < entries_count; i++) {
+		const char *filename = argv[i + 2];
+		if (strlen(filename) >= RC_TEXPACK_MAX_FILENAME) {
+			fprintf(stderr, "Filename '%s' is too long!\n", filename);
+			return EXIT_FAILURE;
+		}
+		int width, height, channels_count;
+		texels[i] = stbi_load(filename, &width, &height, &channels_count, 4);
+		if (!texels[i]) {
+			fprintf(stderr, "Unable to load '%s': %s\n", filename, stbi_failure_reason());
+			return EXIT_FAILURE;
+		}
+
+		// Black is transparent in images without an alpha channel, the same as when the game decodes them
+		if (channels_count == 1 || channels_count == 3)
+			for (int j = 0; j < width * height; j++)
+				if (!texels[i][4 * j + 0] && !texels[i][4 * j + 1] && !texels[i][4 * j + 2])
+					texels[i][4 * j + 3] = 0;
+		strcpy(entries[i].filename, filename);
+		entries[i].width = width;
+		entries[i].height = height;
+		entries[i].offset = offset;
+		offset = align_offset(offset + (uint64_t) width * height * 4);
+		printf("Packing '%s' (%ix%i)\n", filename, width, height);
+	}
+
+	FILE *file = fopen(argv[1], "wb");
+	if (!file) {
+		fprintf(stderr, "Unable to open '%s' for writing!\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	struct rc_texpack_header header = { .version = RC_TEXPACK_VERSION, .entries_count = entries_count };
+	memcpy(header.magic, RC_TEXPACK_MAGIC, sizeof header.magic);
+	fwrite(&header, sizeof header, 1, file);
+	fwrite(entries, sizeof *entries, entries_count, file);
+	for (int i = 0; i < entries_count; i++) {
+		fseek(file, entries[i].offset, SEEK_SET);
+		fwrite(texels[i], 4, (size_t) entries[i].width * entries[i].height, file);
+		stbi_image_free(texels[i]);
+	}
+
+	// Pad the end so the last entry is a whole number of aligned blocks
+	fseek(file, offset - 1, SEEK_SET);
+	fputc(0, file);
+	if (fclose(file)) {
+		fprintf(stderr, "Unable to write '%s'!\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	printf("Packed %i textures into '%s'\n", entries_count, argv[1]);
+	free(entries);
+	free(texels);
+	return EXIT_SUCCESS;
+}